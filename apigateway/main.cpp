@@ -2,13 +2,13 @@
 #include <cxxopts.hpp>
 
 //
-#include <regex>
 #include <optional>
 #include <chrono>
 #include <thread>
 
 #include <consulcpp/ConsulCpp>
 
+#include "../utils/options.h"
 #include "../utils/otutils.h"
 #include "../utils/server.h"
 #include "../utils/consul_client.h"
@@ -26,6 +26,12 @@ public:
 	{
 		mForecastingPort = forePort;
 		mPricePort = pricePort;
+
+		static constexpr utils::Route<MyHTTPServer>	Routes[] = {
+			{ "/health", &MyHTTPServer::health },
+			{ "/forecasting/{symbol}", &MyHTTPServer::readForecasting },
+		};
+		setRoutes( Routes );
 	}
 
 	bool discover( const consulcpp::Consul & consul )
@@ -35,109 +41,112 @@ public:
 
 		using namespace std::chrono_literals;
 
-		auto previousSignal = std::signal( SIGINT, HTTPServer::signalHandler );
-
-		while( mSignalStatus == 0 && ( forePort == 0 || pricePort == 0 )){
-			mLogger->debug( "Looking for services..." );
+		while( !utils::Shutdown::instance().requested() && ( forePort == 0 || pricePort == 0 )){
+			LOG_DEBUG( mLogger, "Looking for services..." );
 			if( forePort == 0 ){
 				if( auto forecaster = consul.services().findInLocal( fmt::format( "forecaster_{}", mGroup )); forecaster ){
 					forePort = forecaster.value().mPort;
-					mLogger->debug( "Forecaster found in port {}", forePort );
+					LOG_DEBUG( mLogger, "Forecaster found in port {}", forePort );
 				}
 			}
 			if( pricePort == 0 ){
 				if( auto priceReader = consul.services().findInLocal( fmt::format( "price-reader_{}",  mGroup )); priceReader ){
 					pricePort = priceReader.value().mPort;
-					mLogger->debug( "Price Reader found in port {}", pricePort );
+					LOG_DEBUG( mLogger, "Price Reader found in port {}", pricePort );
 				}
 			}
 			if( forePort == 0 || pricePort == 0 ){
-				std::this_thread::sleep_for( 1s );
+				utils::Shutdown::instance().waitFor( 1s );
 			}
 		}
 		mForecastingPort = forePort;
 		mPricePort = pricePort;
-
-		std::signal( SIGINT, previousSignal );
+		if( mForecastingPort > 0 && mPricePort > 0 ){
+			mForecastingClient = std::make_unique<client::http_client>( utility::conversions::to_string_t( fmt::format( "http://localhost:{}", mForecastingPort )));
+			mPriceClient = std::make_unique<client::http_client>( utility::conversions::to_string_t( fmt::format( "http://localhost:{}", mPricePort )));
+		}
 
 		return mForecastingPort > 0 && mPricePort > 0;
 	}
 
-	void get( http_request & request ) override
-	{
-		const std::string 		uri = utility::conversions::to_utf8string( request.request_uri().to_string() );
-
-		mLogger->debug( "{} {} from {}", utility::conversions::to_utf8string( request.method() ), uri, utility::conversions::to_utf8string( request.remote_address() ));
-
-		if( uri == "/health" ){
-			request.reply( status_codes::OK, "{}", "application/json; charset=utf-8" );
-		}else{
-			const std::regex 		rgx("/forecasting/(\\w+)");
-			std::smatch 			match;
-
-			if( std::regex_search( uri.begin(), uri.end(), match, rgx )){
-				auto				span = utils::newSpan( request, "read-forecasting" );
-				const std::string	symbol = match[1];
-				const auto 			priceMaybe = getPrice( symbol, span->context() );
-
-				span->SetTag( "symbol", symbol );
+private:
+	int		mForecastingPort = 0;
+	int		mPricePort = 0;
+	// Shared by the requests, so their connections are kept between calls
+	std::unique_ptr<client::http_client>	mForecastingClient;
+	std::unique_ptr<client::http_client>	mPriceClient;
 
-				if( priceMaybe ){
-					mLogger->debug( "Price for symbol {}: {}", symbol, priceMaybe.value() );
+	void readForecasting( http_request & request, const utils::RouteParams & params )
+	{
+		// Before discover finds the services
+		if( !mForecastingClient || !mPriceClient ){
+			LOG_LIMITED( mLogger, spdlog::level::err, "Services not discovered yet" );
+			request.reply( status_codes::ServiceUnavailable, "{}", "application/json; charset=utf-8" );
+			return;
+		}
+		if( !utils::isWord( params[0] )){
+			request.reply( status_codes::BadRequest, "{}", "application/json; charset=utf-8" );
+			return;
+		}
+		auto				span = utils::newSpan( request, "read-forecasting" );
+		const std::string	symbol( params[0] );
+		const auto 			priceMaybe = getPrice( symbol, span->context() );
 
-					const auto foreMaybe = getForecasting( symbol, priceMaybe.value(), span->context() );
-					if( foreMaybe ){
-						span->SetTag( "http.status_code", status_codes::OK );
+		if( utils::isSampled( span->context() )){
+			span->SetTag( utils::tags::Symbol, opentracing::string_view( symbol.data(), symbol.size() ));
+		}
 
-						mLogger->debug( "Forecasting for symbol {}: {}", symbol, foreMaybe.value() );
-						request.reply( status_codes::OK, fmt::format( "{{ \"value\": {} }}", foreMaybe.value() ), "application/json; charset=utf-8" );
-					}else{
-						span->SetTag( "error", true );
-						span->SetTag( "http.status_code", status_codes::NotFound );
+		if( priceMaybe ){
+			LOG_DEBUG( mLogger, "Price for symbol {}: {}", symbol, priceMaybe.value() );
 
-						mLogger->error( "No forecasting for symbol {}", symbol );
-						request.reply( status_codes::NotFound, "{}", "application/json; charset=utf-8" );
-					}
-				}else{
-					span->SetTag( "error", true );
-					span->SetTag( "http.status_code", status_codes::NotFound );
+			const auto foreMaybe = getForecasting( symbol, priceMaybe.value(), span->context() );
+			if( foreMaybe ){
+				utils::setHTTPStatus( *span, status_codes::OK );
 
-					mLogger->error( "No price for symbol {}", symbol );
-					request.reply( status_codes::NotFound, "{}", "application/json; charset=utf-8" );
-				}
-				span->Finish();
+				LOG_DEBUG( mLogger, "Forecasting for symbol {}: {}", symbol, foreMaybe.value() );
+				request.reply( status_codes::OK, fmt::format( "{{ \"value\": {} }}", foreMaybe.value() ), "application/json; charset=utf-8" );
 			}else{
-				mLogger->error( "Unknown route {}", uri );
+				utils::setHTTPStatus( *span, status_codes::NotFound );
+
+				LOG_LIMITED( mLogger, spdlog::level::err, "No forecasting for symbol {}", symbol );
 				request.reply( status_codes::NotFound, "{}", "application/json; charset=utf-8" );
 			}
+		}else{
+			utils::setHTTPStatus( *span, status_codes::NotFound );
+
+			LOG_LIMITED( mLogger, spdlog::level::err, "No price for symbol {}", symbol );
+			request.reply( status_codes::NotFound, "{}", "application/json; charset=utf-8" );
 		}
+		span->Finish();
 	}
 
-private:
-	int		mForecastingPort = 0;
-	int		mPricePort = 0;
-
 	std::optional<float> getPrice( const std::string & symbol, const opentracing::SpanContext & spanContext )
 	{
-		mLogger->debug( "Reading last value for symbol {}", symbol );
+		LOG_DEBUG( mLogger, "Reading last value for symbol {}", symbol );
 
 		std::optional<float>	res;
-		const std::string 		query = fmt::format( "http://localhost:{}/value/{}", mPricePort, symbol );
-		client::http_client 	client( utility::conversions::to_string_t( query ));
 		http_request			req( methods::GET );
 
-		utils::injectContext( spanContext, req );
+		req.set_request_uri( utility::conversions::to_string_t( fmt::format( "/value/{}", symbol )));
+
+		utils::ClientSpan		clientSpan( "get-price", spanContext, "price-reader", req );
 
-		client.request( req ).then([ this ](http_response response){
+		mPriceClient->request( req ).then([ &clientSpan, this ](http_response response){
+			clientSpan.phase( utils::ClientSpan::HeadersReceived );
+			utils::setHTTPStatus( clientSpan.span(), response.status_code() );
 			if( response.status_code() == status_codes::OK ){
 				return response.extract_json();
 			}
-			mLogger->error( "Error accessing the symbol price. No value found. Error: {}", response.status_code() );
+			LOG_LIMITED( mLogger, spdlog::level::err, "Error accessing the symbol price. No value found. Error: {}", response.status_code() );
 			return pplx::task_from_result(json::value());
-		}).then([ &res, this ](pplx::task<json::value> previousTask){
+		}).then([ &res, &clientSpan, this ](pplx::task<json::value> previousTask){
 			try{
 				const auto jsonRes = previousTask.get();
 
+				if( !jsonRes.is_null() ){
+					clientSpan.phase( utils::ClientSpan::BodyParsed );
+				}
+
 				if( jsonRes.has_field( utility::conversions::to_string_t( "value" )) ){
 					const auto jsonValue = jsonRes.at( utility::conversions::to_string_t( "value" ));
 
@@ -148,15 +157,16 @@ private:
 							res = std::stod( jsonValue.as_string() );
 						}
 					}else{
-						mLogger->error( "Error accessing the symbol price. Invalid response." );
+						LOG_LIMITED( mLogger, spdlog::level::err, "Error accessing the symbol price. Invalid response." );
 					}
 				}else{
-					mLogger->error( "Error accessing the symbol price. No value found." );
+					LOG_LIMITED( mLogger, spdlog::level::err, "Error accessing the symbol price. No value found." );
 				}
 			}catch( const http_exception & e ){
-				mLogger->error( "Error accessing the symbol price {}", e.what() );
+				clientSpan.setError();
+				LOG_LIMITED( mLogger, spdlog::level::err, "Error accessing the symbol price {}", e.what() );
 			}catch(...){
-				mLogger->error( "Error accessing the symbol price" );
+				LOG_LIMITED( mLogger, spdlog::level::err, "Error accessing the symbol price" );
 			}
 		}).wait();
 
@@ -165,24 +175,30 @@ private:
 
 	std::optional<float> getForecasting( const std::string & symbol, float currentValue, const opentracing::SpanContext & spanContext )
 	{
-		mLogger->debug( "Requesting forecasting for symbol {} at {}", symbol, currentValue );
+		LOG_DEBUG( mLogger, "Requesting forecasting for symbol {} at {}", symbol, currentValue );
 
 		std::optional<float>	res;
-		const std::string 		query = fmt::format( "http://localhost:{}/forecasting?symbol={}&value={}", mForecastingPort, symbol, currentValue );
-		client::http_client 	client( utility::conversions::to_string_t( query ));
 		http_request			req( methods::GET );
 
-		utils::injectContext( spanContext, req );
+		req.set_request_uri( utility::conversions::to_string_t( fmt::format( "/forecasting?symbol={}&value={}", symbol, currentValue )));
+
+		utils::ClientSpan		clientSpan( "get-forecasting", spanContext, "forecaster", req );
 
-		client.request( req ).then([ this ](http_response response){
+		mForecastingClient->request( req ).then([ &clientSpan, this ](http_response response){
+			clientSpan.phase( utils::ClientSpan::HeadersReceived );
+			utils::setHTTPStatus( clientSpan.span(), response.status_code() );
 			if( response.status_code() == status_codes::OK ){
 				return response.extract_json();
 			}
-			mLogger->error( "Error accessing the symbol forecasting. Error: {}", response.status_code() );
+			LOG_LIMITED( mLogger, spdlog::level::err, "Error accessing the symbol forecasting. Error: {}", response.status_code() );
 			return pplx::task_from_result(json::value());
-		}).then([ &res, this ](pplx::task<json::value> previousTask){
+		}).then([ &res, &clientSpan, this ](pplx::task<json::value> previousTask){
 			try{
 				const auto jsonRes = previousTask.get();
+
+				if( !jsonRes.is_null() ){
+					clientSpan.phase( utils::ClientSpan::BodyParsed );
+				}
 				const auto jsonValue = jsonRes.at( utility::conversions::to_string_t( "value" ));
 
 				if( !jsonValue.is_null() && (jsonValue.is_number() || jsonValue.is_string())){
@@ -193,7 +209,8 @@ private:
 					}
 				}
 			}catch( const http_exception & e ){
-				mLogger->error( "Error accessing the symbol forecasting {}", e.what() );
+				clientSpan.setError();
+				LOG_LIMITED( mLogger, spdlog::level::err, "Error accessing the symbol forecasting {}", e.what() );
 			}
 		}).wait();
 
@@ -205,11 +222,13 @@ int main( int argc, char * argv[])
 {
 	cxxopts::Options 	options( argv[0], "API Gateway" );
 	int					port = 0;
-	bool				verbose = false;
 	int					forecastingPort = 0;
 	int 				pricePort = 0;
-	std::string			logFile;
-	std::string			graylogHost;
+	utils::LoggerConfig	logConfig;
+	utils::SamplingConfig	samplingConfig;
+	utils::TracerConfig		tracerConfig;
+	utils::ThreadsConfig	threadsConfig;
+	int					drainMs = 0;
 	std::string			group;
 	std::string			appName = "api-gateway";
 
@@ -217,12 +236,15 @@ int main( int argc, char * argv[])
 	 	.positional_help("[optional args]")
 		.show_positional_help();
 
+	utils::addCommonOptions( options, logConfig, samplingConfig, tracerConfig, threadsConfig, drainMs );
 	options.add_options()
 		("g,group", "service group", cxxopts::value<std::string>( group ) )
-		("help", "Print help")
-		("v,verbose", "Increase log level", cxxopts::value<bool>( verbose )->default_value("false") )
-		("log-file", "Log file", cxxopts::value<std::string>( logFile ) )
-		("graylog-host", "schema://host:port. Example: http://localhost:12201", cxxopts::value<std::string>( graylogHost ) )
+		("trace-tail", "Keep each trace until the request ends, export it only if slow, failed or by --trace-tail-baseline", cxxopts::value<bool>( tracerConfig.mTail.mEnabled )->default_value("false") )
+		("trace-tail-slow-ms", "Traces slower than this are kept with --trace-tail", cxxopts::value<int>( tracerConfig.mTail.mSlowMs )->default_value( "1000" ) )
+		("trace-tail-status", "Traces with an HTTP status code from this one up are kept with --trace-tail", cxxopts::value<int>( tracerConfig.mTail.mMinStatus )->default_value( "500" ) )
+		("trace-tail-baseline", "Probability of keeping any other trace with --trace-tail", cxxopts::value<double>( tracerConfig.mTail.mBaseline )->default_value( "0.01" ) )
+		("trace-tail-max-mb", "Max memory of the traces waiting for a decision, the oldest are dropped", cxxopts::value<size_t>( tracerConfig.mTail.mMaxMB )->default_value( "64" ) )
+		("trace-tail-listen", "udp://host:port where price-reader and forecaster send their spans (their --trace-export), so whole traces are kept", cxxopts::value<std::string>( tracerConfig.mTail.mListen ) )
 		("p,port", "Port", cxxopts::value<int>( port )->default_value( "16000" ) )
 		("forecasting-port", "Port for the forecasting service.", cxxopts::value<int>( forecastingPort )->default_value( "16001" ) )
 		("reader-port", "Port for the symbol reader service.", cxxopts::value<int>( pricePort )->default_value( "16002" ) );
@@ -237,14 +259,26 @@ int main( int argc, char * argv[])
     	spdlog::critical( "error parsing options: {}", e.what() );
     	exit(1);
 	}
+	utils::HTTPServer::startListeners( threadsConfig, logConfig );
+	utils::Shutdown::instance().block();
+	utils::HTTPServer::initThreads( threadsConfig );
 	consulcpp::Consul		consul;
 
 	if( consul.connect() ){
-		MyHTTPServer				server( forecastingPort, pricePort, utils::newLogger( appName, verbose, logFile, graylogHost ) );
+		MyHTTPServer				server( forecastingPort, pricePort, utils::newLogger( appName, logConfig ) );
 		consulcpp::Service			service;
 		consulcpp::ServiceCheck		check;
 		consulcpp::Leader::Status	leaderStatus = consulcpp::Leader::Status::No;
 
+		server.setTailLog( logConfig.mTail );
+		if( logConfig.mSampledDebug ){
+			server.setSampledLogLevel( spdlog::level::debug );
+		}
+		server.setSampling( samplingConfig );
+		server.setTracing( tracerConfig );
+		server.setThreads( threadsConfig );
+		server.setDrain( std::chrono::milliseconds( drainMs ));
+
 		service.mId = fmt::format( "{}_{}", appName, group );
 		service.mName = appName;
 		service.mAddress = consul.address();
@@ -286,12 +320,17 @@ int main( int argc, char * argv[])
 		});
 		observer.run();
 
+		const auto deregister = [ & ](){
+			consul.leader().release( service, session );
+			consul.sessions().destroy( session );
+			consul.services().destroy( service );
+		};
+
 		if( server.discover( consul ) ){
-			server.run( service.mName, service.mPort );
+			server.run( service.mName, service.mPort, deregister );
+		}else{
+			deregister();
 		}
-		consul.leader().release( service, session );
-		consul.sessions().destroy( session );
-		consul.services().destroy( service );	
 	}else{
 
 	}
@@ -0,0 +1,70 @@
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include <spdlog/sinks/basic_file_sink.h>
+
+// Release builds compile debug statements out by default
+#define LOG_ACTIVE_LEVEL SPDLOG_LEVEL_DEBUG
+
+#include "../utils/log.h"
+
+// A debug statement of a request written to the log file: formatted by spdlog into a text file, as
+// --log-file does, and stored by LOG_DEBUG into the binary log only, as --log-binary-level debug does.
+// The binary records of a request carry its trace and span ids, about 50 bytes more.
+
+template<typename Function>
+static double nsPerCall( int calls, Function && function )
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for( int i = 0; i < calls; i++ ){
+		function( i );
+	}
+	return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count() / calls;
+}
+
+int main()
+{
+	constexpr int			Calls = 2000000;
+	const auto				directory = std::filesystem::temp_directory_path();
+	const std::string		textPath = ( directory / "bench_binlog.log" ).string();
+	const std::string		binaryPath = ( directory / "bench_binlog.bin" ).string();
+	const auto				method = std::string( "GET" );
+	utils::LogContext		context;
+	auto					text = std::make_shared<spdlog::logger>( "bench", std::make_shared<spdlog::sinks::basic_file_sink_st>( textPath, true ));
+
+	context.set( 0x0af7651916cd43dd, 0x8448eb211c80319c, 0xb7ad6b7169203331 );
+
+	text->set_formatter( utils::newTraceFormatter() );
+	text->set_level( spdlog::level::debug );
+
+	const double formatted = nsPerCall( Calls, [ & ]( int i ){
+		const utils::LogContext::Scope	scope( context );
+
+		LOG_DEBUG( text, "{} /forecasting/{} from {}, {} bytes", method, i, "127.0.0.1", 1.5 * i );
+	});
+	text->flush();
+
+	auto	binary = std::make_shared<spdlog::logger>( "bench", std::make_shared<spdlog::sinks::basic_file_sink_st>( textPath, true ));
+
+	binary->set_level( spdlog::level::info );
+	utils::BinaryLog::activate( std::make_shared<utils::BinaryLog>( binaryPath, 64 * 1048576, "bench", spdlog::level::debug ));
+
+	const double stored = nsPerCall( Calls, [ & ]( int i ){
+		LOG_DEBUG( binary, "{} /forecasting/{} from {}, {} bytes", method, i, "127.0.0.1", 1.5 * i );
+	});
+	const double storedInRequest = nsPerCall( Calls, [ & ]( int i ){
+		const utils::LogContext::Scope	scope( context );
+
+		LOG_DEBUG( binary, "{} /forecasting/{} from {}, {} bytes", method, i, "127.0.0.1", 1.5 * i );
+	});
+	utils::BinaryLog::activate( nullptr );
+
+	std::printf( "debug to the log file: text %.1f ns/call, binary %.1f ns/call, binary with trace ids %.1f ns/call\n", formatted, stored, storedInRequest );
+	std::filesystem::remove( textPath );
+	std::filesystem::remove( binaryPath );
+	return 0;
+}
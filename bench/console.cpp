@@ -0,0 +1,65 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include "../utils/console_sink.h"
+
+// Info messages logged to the console from 1 to 8 threads, with stdout redirected to /dev/null: the
+// stdout_color_sink_mt kind of sink, one locked fwrite and fflush for each line, and console_sink, the staged
+// writer of newLogger. Times are wall time per message of all the threads, flush included.
+
+template<typename Sink>
+static double measure( const std::shared_ptr<Sink> & sink, int threads, int messages )
+{
+	auto								logger = std::make_shared<spdlog::logger>( "bench", sink );
+	std::vector<std::thread>			workers;
+	const auto							start = std::chrono::steady_clock::now();
+
+	for( int t = 0; t < threads; t++ ){
+		workers.emplace_back( [ & ](){
+			for( int i = 0; i < messages / threads; i++ ){
+				logger->info( "Forecasting {} for {} days: value {}", "AMZN", i, 3127.5 );
+			}
+		});
+	}
+	for( auto & worker: workers ){
+		worker.join();
+	}
+	logger->flush();
+	return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count() / messages;
+}
+
+int main()
+{
+	constexpr int	Messages = 200000;
+	const int		devNull = open( "/dev/null", O_WRONLY );
+	const int		out = dup( STDOUT_FILENO );
+
+	if( devNull < 0 || out < 0 ){
+		std::perror( "bench_console" );
+		return 1;
+	}
+	std::printf( "threads  stdout_color_sink_mt  console_sink  (ns/message)\n" );
+	std::fflush( stdout );
+	for( int threads: { 1, 2, 4, 8 } ){
+		dup2( devNull, STDOUT_FILENO );
+
+		const double	locked = measure( std::make_shared<spdlog::sinks::stdout_color_sink_mt>(), threads, Messages );
+		const double	staged = measure( std::make_shared<utils::console_sink>(), threads, Messages );
+
+		std::fflush( stdout );
+		dup2( out, STDOUT_FILENO );
+		std::printf( "%7d  %20.1f  %12.1f\n", threads, locked, staged );
+		std::fflush( stdout );
+	}
+	close( devNull );
+	close( out );
+	return 0;
+}
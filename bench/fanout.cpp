@@ -0,0 +1,111 @@
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include <spdlog/sinks/null_sink.h>
+#include <spdlog/details/log_msg_buffer.h>
+
+#include "../utils/fanout_sink.h"
+
+// An info message logged to two sinks: written by the calling thread, and queued to fanout_sink, that writes
+// them from their own threads. The shared_ptr copy is what fanout_sink made of each message before it
+// recycled them. Times are CPU time of the calling thread, so the sink threads do not count even when they
+// share its CPU; allocations are counted in every thread.
+
+static std::atomic<bool>		gCount{ false };
+static std::atomic<size_t>		gAllocations{ 0 };
+static volatile size_t			gBytes = 0;
+
+void * operator new( size_t size )
+{
+	if( gCount ){
+		gAllocations++;
+	}
+	void * res = std::malloc( size > 0 ? size : 1 );
+
+	if( !res ){
+		throw std::bad_alloc();
+	}
+	return res;
+}
+
+void operator delete( void * ptr ) noexcept
+{
+	std::free( ptr );
+}
+
+void operator delete( void * ptr, size_t ) noexcept
+{
+	std::free( ptr );
+}
+
+static double threadNs()
+{
+	timespec	now{};
+
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now );
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+template<typename Function>
+static void measure( const char * name, int calls, Function && function )
+{
+	gAllocations = 0;
+	gCount = true;
+
+	const double start = threadNs();
+
+	for( int i = 0; i < calls; i++ ){
+		function( i );
+	}
+	const double elapsed = threadNs() - start;
+
+	gCount = false;
+	std::printf( "%s: %.1f ns/message, %.2f allocations/message\n", name, elapsed / calls, static_cast<double>( gAllocations ) / calls );
+}
+
+int main()
+{
+	constexpr int	Messages = 1000000;
+	const std::vector<std::pair<std::string, spdlog::sink_ptr>> sinks = {
+		{ "console", std::make_shared<spdlog::sinks::null_sink_mt>() },
+		{ "file", std::make_shared<spdlog::sinks::null_sink_mt>() }
+	};
+	auto			direct = std::make_shared<spdlog::logger>( "bench" );
+	auto			fanout = std::make_shared<utils::fanout_sink>( sinks, 8192 );
+	auto			queued = std::make_shared<spdlog::logger>( "bench", fanout );
+
+	for( const auto & sink: sinks ){
+		direct->sinks().push_back( sink.second );
+	}
+	measure( "sinks written by the caller", Messages, [ & ]( int i ){
+		direct->info( "Forecasting {} for {} days: value {}", "AMZN", i, 3127.5 );
+	});
+	// The first messages fill the pool
+	for( int i = 0; i < 100000; i++ ){
+		queued->info( "Forecasting {} for {} days: value {}", "AMZN", i, 3127.5 );
+	}
+	measure( "fanout_sink", Messages, [ & ]( int i ){
+		queued->info( "Forecasting {} for {} days: value {}", "AMZN", i, 3127.5 );
+	});
+	measure( "shared_ptr copy of the message", Messages, [ & ]( int ){
+		const spdlog::details::log_msg	msg( "bench", spdlog::level::info, "Forecasting AMZN for 7 days: value 3127.5" );
+		const auto						copy = std::make_shared<const spdlog::details::log_msg_buffer>( msg );
+
+		gBytes = gBytes + copy->payload.size();
+	});
+
+	const auto stats = fanout->stats();
+
+	std::printf( "fanout_sink lost %llu messages in the queue of the caller", static_cast<unsigned long long>( stats.mDropped ));
+	for( const auto & sink: stats.mSinks ){
+		std::printf( ", %llu in %s", static_cast<unsigned long long>( sink.mDropped ), sink.mName.c_str() );
+	}
+	std::printf( "\n" );
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef CPPREST_ENABLED
+// https://github.com/Microsoft/cpprestsdk
+#include <cpprest/json.h>
+#endif
+
+#include "../utils/gelf_encoder.h"
+
+// Heap allocations, allocated bytes and time per message of GelfEncoder, the encoder of graylog_sink, and of
+// the cpprest json::value it replaced (built when cpprestsdk is found)
+
+static std::atomic<bool>		gCount{ false };
+static std::atomic<size_t>		gAllocations{ 0 };
+static std::atomic<size_t>		gAllocatedBytes{ 0 };
+
+void * operator new( size_t size )
+{
+	if( gCount ){
+		gAllocations++;
+		gAllocatedBytes += size;
+	}
+	void * res = std::malloc( size > 0 ? size : 1 );
+
+	if( !res ){
+		throw std::bad_alloc();
+	}
+	return res;
+}
+
+void operator delete( void * ptr ) noexcept
+{
+	std::free( ptr );
+}
+
+void operator delete( void * ptr, size_t ) noexcept
+{
+	std::free( ptr );
+}
+
+template<typename Function>
+static void measure( const char * name, int messages, Function && function )
+{
+	size_t	bytes = 0;
+
+	gAllocations = 0;
+	gAllocatedBytes = 0;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	gCount = true;
+	for( int i = 0; i < messages; i++ ){
+		bytes += function();
+	}
+	gCount = false;
+
+	const auto elapsed = std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count();
+
+	std::printf( "%s: %.1f ns/message, %.2f allocations/message, %.0f allocated bytes/message, %zu bytes of JSON\n", name, elapsed / messages,
+		static_cast<double>( gAllocations ) / messages, static_cast<double>( gAllocatedBytes ) / messages, bytes / messages );
+}
+
+int main()
+{
+	constexpr int					Messages = 1000000;
+	const utils::GelfEncoder		encoder( "bench-host" );
+	const spdlog::details::log_msg	msg( "bench", spdlog::level::info, "Forecasting \"AMZN\" for 7 days:\tvalue 3127.5" );
+	fmt::memory_buffer				out;
+
+	// The first message grows the buffer
+	encoder.encode( msg, out );
+	measure( "GelfEncoder", Messages, [ & ](){
+		encoder.encode( msg, out );
+		return out.size();
+	});
+#ifdef CPPREST_ENABLED
+	const std::string	hostName( "bench-host" );
+
+	// As graylog_sink built each message before GelfEncoder
+	measure( "web::json::value", Messages, [ & ](){
+		web::json::value	logJSON;
+
+		logJSON[U("version")] = web::json::value::string( U("1.1") );
+		logJSON[U("host")] = web::json::value::string( utility::conversions::to_string_t( hostName ));
+		logJSON[U("short_message")] = web::json::value::string( utility::conversions::to_string_t( fmt::format( msg.payload )));
+		logJSON[U("timestamp")] = web::json::value::number( std::chrono::duration_cast<std::chrono::milliseconds>( msg.time.time_since_epoch() ).count() / 1000.0 );
+		logJSON[U("level")] = web::json::value::number( utils::gelfLevel( msg.level ));
+
+		return utility::conversions::to_utf8string( logJSON.serialize() ).size();
+	});
+#else
+	std::printf( "web::json::value: not measured, cpprestsdk not found\n" );
+#endif
+	return 0;
+}
@@ -0,0 +1,158 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// https://github.com/jarro2783/cxxopts
+#include <cxxopts.hpp>
+
+#include <fmt/format.h>
+
+// Loopback load test of a running service: each thread sends GET requests one after the other, on a kept
+// connection or on a new one for each request (--new-connections, which loads the accepts). Prints the
+// requests per second and the latency percentiles. Compare --listeners 1 and N of the service.
+
+using Clock = std::chrono::steady_clock;
+
+static int connectTo( const sockaddr_in & address )
+{
+	const int	one = 1;
+	const int	fd = socket( AF_INET, SOCK_STREAM, 0 );
+
+	setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ));
+	if( connect( fd, reinterpret_cast<const sockaddr *>( &address ), sizeof( address )) != 0 ){
+		close( fd );
+		return -1;
+	}
+	return fd;
+}
+
+// Reads one response, its headers and Content-Length bytes of body. Returns false on errors.
+static bool readResponse( int fd, std::string & buffer )
+{
+	size_t	headersEnd = std::string::npos;
+	size_t	length = 0;
+	char	chunk[4096];
+
+	buffer.clear();
+	while( true ){
+		if( headersEnd == std::string::npos && ( headersEnd = buffer.find( "\r\n\r\n" )) != std::string::npos ){
+			const auto header = buffer.find( "Content-Length:" );
+
+			headersEnd += 4;
+			length = header != std::string::npos && header < headersEnd ? std::strtoul( buffer.c_str() + header + 15, nullptr, 10 ) : 0;
+		}
+		if( headersEnd != std::string::npos && buffer.size() >= headersEnd + length ){
+			return buffer.compare( 0, 12, "HTTP/1.1 200" ) == 0;
+		}
+		const ssize_t size = read( fd, chunk, sizeof( chunk ));
+
+		if( size <= 0 ){
+			return false;
+		}
+		buffer.append( chunk, static_cast<size_t>( size ));
+	}
+}
+
+int main( int argc, char * argv[])
+{
+	cxxopts::Options 	options( argv[0], "Loopback HTTP load test" );
+	int					port = 0;
+	std::string			path;
+	size_t				threads = 0;
+	int					seconds = 0;
+	bool				newConnections = false;
+
+	options.add_options()
+		("help", "Print help")
+		("p,port", "Port of the service, on 127.0.0.1", cxxopts::value<int>( port )->default_value( "16002" ) )
+		("path", "Path requested", cxxopts::value<std::string>( path )->default_value( "/health" ) )
+		("threads", "Threads sending requests", cxxopts::value<size_t>( threads )->default_value( "8" ) )
+		("seconds", "Duration of the test", cxxopts::value<int>( seconds )->default_value( "10" ) )
+		("new-connections", "Connect for each request", cxxopts::value<bool>( newConnections )->default_value("false") );
+
+	try{
+		const auto result = options.parse(argc, argv);
+		if( result.count( "help" ) > 0 ){
+			std::cout << options.help({ "" }) << std::endl;
+			exit(0);
+		}
+	}catch(const cxxopts::OptionException& e){
+		std::cerr << "error parsing options: " << e.what() << std::endl;
+		exit(1);
+	}
+
+	const std::string					request = fmt::format( "GET {} HTTP/1.1\r\nHost: 127.0.0.1:{}\r\n\r\n", path, port );
+	const auto							deadline = Clock::now() + std::chrono::seconds( seconds );
+	std::vector<std::vector<uint32_t>>	latencies( threads );		// us
+	std::vector<std::thread>			workers;
+	std::atomic<uint64_t>				errors{ 0 };
+	sockaddr_in							address{};
+
+	address.sin_family = AF_INET;
+	address.sin_port = htons( static_cast<uint16_t>( port ));
+	address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	for( size_t i = 0; i < threads; i++ ){
+		workers.emplace_back( [ &, i ](){
+			std::string		buffer;
+			int				fd = -1;
+
+			while( Clock::now() < deadline ){
+				const auto start = Clock::now();
+
+				if( fd < 0 ){
+					fd = connectTo( address );
+				}
+				if( fd < 0 || write( fd, request.data(), request.size() ) != static_cast<ssize_t>( request.size() ) || !readResponse( fd, buffer )){
+					errors++;
+					if( fd >= 0 ){
+						close( fd );
+					}
+					fd = -1;
+					continue;
+				}
+				if( newConnections ){
+					close( fd );
+					fd = -1;
+				}
+				latencies[i].push_back( static_cast<uint32_t>( std::chrono::duration_cast<std::chrono::microseconds>( Clock::now() - start ).count() ));
+			}
+			if( fd >= 0 ){
+				close( fd );
+			}
+		});
+	}
+	for( auto & worker: workers ){
+		worker.join();
+	}
+
+	std::vector<uint32_t>	all;
+
+	for( const auto & latency: latencies ){
+		all.insert( all.end(), latency.begin(), latency.end() );
+	}
+	std::sort( all.begin(), all.end() );
+	if( all.empty() ){
+		std::cerr << "No request answered, " << errors << " errors" << std::endl;
+		return 1;
+	}
+	const auto percentile = [ & ]( double p ){
+		return all[ std::min( all.size() - 1, static_cast<size_t>( p * all.size() )) ];
+	};
+
+	std::cout << fmt::format( "{} threads{}: {:.0f} requests/s, latency p50 {} us, p99 {} us, max {} us, {} errors\n", threads, newConnections ? ", new connections" : "",
+		static_cast<double>( all.size() ) / seconds, percentile( 0.5 ), percentile( 0.99 ), all.back(), errors.load() );
+	return 0;
+}
@@ -0,0 +1,43 @@
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include <spdlog/sinks/null_sink.h>
+
+// Release builds compile debug statements out by default, this measures them disabled at run time
+#define LOG_ACTIVE_LEVEL SPDLOG_LEVEL_DEBUG
+
+#include "../utils/log.h"
+
+// A disabled debug statement, like the one of each request, through spdlog and through LOG_DEBUG
+
+template<typename Function>
+static double nsPerCall( int calls, Function && function )
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for( int i = 0; i < calls; i++ ){
+		function( i );
+	}
+	return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count() / calls;
+}
+
+int main()
+{
+	constexpr int	Calls = 20000000;
+	auto			logger = std::make_shared<spdlog::logger>( "bench", std::make_shared<spdlog::sinks::null_sink_st>() );
+	const auto		method = std::string( "GET" );
+
+	logger->set_level( spdlog::level::info );
+
+	const double direct = nsPerCall( Calls, [ & ]( int i ){
+		logger->debug( "{} {} from {}", method, std::to_string( i ), "127.0.0.1" );
+	});
+	const double macro = nsPerCall( Calls, [ & ]( int i ){
+		LOG_DEBUG( logger, "{} {} from {}", method, std::to_string( i ), "127.0.0.1" );
+	});
+
+	std::printf( "debug disabled: logger->debug() %.1f ns/call, LOG_DEBUG %.1f ns/call\n", direct, macro );
+	return 0;
+}
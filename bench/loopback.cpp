@@ -0,0 +1,132 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+// Latency of one small HTTP call over loopback: a new TCP connection for each call, as the gateway did,
+// a kept TCP connection, as it does now, and a kept Unix domain socket connection, which cpprest can not use.
+// The server answers any read with a fixed response, so this is the cost of the transport only.
+
+static constexpr char	Request[] = "GET /value/AMZN HTTP/1.1\r\nHost: localhost\r\ntraceparent: 00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01\r\n\r\n";
+static constexpr char	Response[] = "HTTP/1.1 200 OK\r\nContent-Type: application/json; charset=utf-8\r\nContent-Length: 17\r\n\r\n{ \"value\": 3000 }";
+
+static void serve( int fd )
+{
+	char	buffer[1024];
+
+	while( read( fd, buffer, sizeof( buffer )) > 0 ){
+		if( write( fd, Response, sizeof( Response ) - 1 ) < 0 ){
+			break;
+		}
+	}
+	close( fd );
+}
+
+static void acceptAll( int listener, bool noDelay )
+{
+	std::thread( [ listener, noDelay ](){
+		int	fd = 0;
+
+		while(( fd = accept( listener, nullptr, nullptr )) >= 0 ){
+			if( noDelay ){
+				const int one = 1;
+
+				setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ));
+			}
+			std::thread( serve, fd ).detach();
+		}
+	}).detach();
+}
+
+static bool call( int fd )
+{
+	char	buffer[1024];
+
+	return write( fd, Request, sizeof( Request ) - 1 ) > 0 && read( fd, buffer, sizeof( buffer )) > 0;
+}
+
+static int connectTCP( const sockaddr_in & address )
+{
+	const int	one = 1;
+	const int	fd = socket( AF_INET, SOCK_STREAM, 0 );
+
+	setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ));
+	if( connect( fd, reinterpret_cast<const sockaddr *>( &address ), sizeof( address )) != 0 ){
+		close( fd );
+		return -1;
+	}
+	return fd;
+}
+
+template<typename Function>
+static double usPerCall( int calls, Function && function )
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for( int i = 0; i < calls; i++ ){
+		function();
+	}
+	return std::chrono::duration<double, std::micro>( std::chrono::steady_clock::now() - start ).count() / calls;
+}
+
+int main()
+{
+	constexpr int		Calls = 20000;
+	const int			one = 1;
+	const std::string	path = "/tmp/bench_loopback.sock";
+	sockaddr_in			tcpAddress{};
+	sockaddr_un			unixAddress{};
+	const int			tcpListener = socket( AF_INET, SOCK_STREAM, 0 );
+	const int			unixListener = socket( AF_UNIX, SOCK_STREAM, 0 );
+	socklen_t			size = sizeof( tcpAddress );
+
+	// Any free port
+	tcpAddress.sin_family = AF_INET;
+	tcpAddress.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	setsockopt( tcpListener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ));
+	if( bind( tcpListener, reinterpret_cast<sockaddr *>( &tcpAddress ), sizeof( tcpAddress )) != 0 || listen( tcpListener, 1024 ) != 0 ||
+		getsockname( tcpListener, reinterpret_cast<sockaddr *>( &tcpAddress ), &size ) != 0 ){
+		std::perror( "TCP listener" );
+		return 1;
+	}
+	unlink( path.c_str() );
+	unixAddress.sun_family = AF_UNIX;
+	std::strncpy( unixAddress.sun_path, path.c_str(), sizeof( unixAddress.sun_path ) - 1 );
+	if( bind( unixListener, reinterpret_cast<sockaddr *>( &unixAddress ), sizeof( unixAddress )) != 0 || listen( unixListener, 1024 ) != 0 ){
+		std::perror( "Unix domain socket listener" );
+		return 1;
+	}
+	acceptAll( tcpListener, true );
+	acceptAll( unixListener, false );
+
+	const double newConnection = usPerCall( Calls / 4, [ & ](){
+		const int fd = connectTCP( tcpAddress );
+
+		call( fd );
+		close( fd );
+	});
+	const int tcp = connectTCP( tcpAddress );
+	const double keptConnection = usPerCall( Calls, [ & ](){
+		call( tcp );
+	});
+	const int uds = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+	connect( uds, reinterpret_cast<const sockaddr *>( &unixAddress ), sizeof( unixAddress ));
+	const double keptUnix = usPerCall( Calls, [ & ](){
+		call( uds );
+	});
+
+	std::printf( "TCP new connection %.1f us/call, TCP kept connection %.1f us/call, Unix domain socket kept connection %.1f us/call\n", newConnection, keptConnection, keptUnix );
+	close( tcp );
+	close( uds );
+	unlink( path.c_str() );
+	return 0;
+}
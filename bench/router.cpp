@@ -0,0 +1,59 @@
+#include <chrono>
+#include <cstdio>
+#include <regex>
+#include <string>
+
+#include "../utils/router.h"
+
+// Matching "/forecasting/AMZN" with the std::regex the handlers used to build, and with utils::Router
+
+struct Request
+{
+	size_t	mMatched = 0;
+};
+
+template<typename Function>
+static double nsPerCall( int calls, Function && function )
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for( int i = 0; i < calls; i++ ){
+		function();
+	}
+	return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count() / calls;
+}
+
+int main()
+{
+	constexpr int			Calls = 200000;
+	const std::string		uri = "/forecasting/AMZN";
+	const std::regex		prebuilt( "/forecasting/(\\w+)" );
+	utils::Router<Request>	router;
+	Request					request;
+
+	router.add( "/health", []( Request &, const utils::RouteParams & ){} );
+	router.add( "/forecasting/{symbol}", []( Request & req, const utils::RouteParams & params ){ req.mMatched += params[0].size(); } );
+	router.add( "/value/{symbol}", []( Request &, const utils::RouteParams & ){} );
+
+	const double perRequest = nsPerCall( Calls, [ & ](){
+		const std::regex	rgx( "/forecasting/(\\w+)" );
+		std::smatch			match;
+
+		if( std::regex_search( uri.begin(), uri.end(), match, rgx )){
+			request.mMatched += match[1].str().size();
+		}
+	});
+	const double once = nsPerCall( Calls, [ & ](){
+		std::smatch		match;
+
+		if( std::regex_search( uri.begin(), uri.end(), match, prebuilt )){
+			request.mMatched += match[1].str().size();
+		}
+	});
+	const double trie = nsPerCall( Calls * 10, [ & ](){
+		router.dispatch( uri, request );
+	});
+
+	std::printf( "regex built per request %.0f ns, regex built once %.0f ns, Router %.1f ns (%zu)\n", perRequest, once, trie, request.mMatched );
+	return 0;
+}
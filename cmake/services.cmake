@@ -0,0 +1,16 @@
+# Settings shared by the services, included after their find_package calls
+
+# utils/listeners.h finds the real bind() with dlsym
+link_libraries( ${CMAKE_DL_LIBS} )
+
+find_package( ZLIB )
+if( ZLIB_FOUND )
+	add_compile_definitions( ZLIB_ENABLED )
+	link_libraries( ZLIB::ZLIB )
+endif()
+
+set( LOG_ACTIVE_LEVEL "" CACHE STRING "Log statements below this level are compiled out: TRACE, DEBUG, INFO, WARN, ERROR. Empty: INFO for release builds, TRACE otherwise. DEBUG keeps the request debug messages of --log-tail and --log-sampled-debug" )
+if( LOG_ACTIVE_LEVEL )
+	string( TOUPPER ${LOG_ACTIVE_LEVEL} LOG_ACTIVE_LEVEL_NAME )
+	add_compile_definitions( LOG_ACTIVE_LEVEL=SPDLOG_LEVEL_${LOG_ACTIVE_LEVEL_NAME} )
+endif()
@@ -5,6 +5,7 @@
 #include <optional>
 #include <consulcpp/ConsulCpp>
 
+#include "../utils/options.h"
 #include "../utils/otutils.h"
 #include "../utils/server.h"
 
@@ -19,53 +20,44 @@ class MyHTTPServer: public utils::HTTPServer
 public:
 	explicit MyHTTPServer( std::shared_ptr<spdlog::logger> logger ) : HTTPServer( logger )
 	{
+		static constexpr utils::Route<MyHTTPServer>	Routes[] = {
+			{ "/health", &MyHTTPServer::health },
+			{ "/forecasting", &MyHTTPServer::forecasting },
+		};
+		setRoutes( Routes );
 	}
 
-	void get( http_request & request ) override
+private:
+	void forecasting( http_request & request, const utils::RouteParams & )
 	{
-		const auto 			uri = request.request_uri();
+		const auto 	uri = request.request_uri();
+		auto		span = utils::newSpan( request, "forecasting" );
+		const auto	query = web::uri::split_query( uri.query() );
 
-		mLogger->debug( "{} {} from {}", utility::conversions::to_utf8string( request.method() ), utility::conversions::to_utf8string( uri.to_string() ), utility::conversions::to_utf8string( request.remote_address() ));
+		if( query.count( utility::conversions::to_string_t( "symbol" )) > 0  && query.count( utility::conversions::to_string_t( "value" )) > 0 ){
+			auto symbol = utility::conversions::to_utf8string( query.at( utility::conversions::to_string_t( "symbol" )));
 
-		if( uri.path() == utility::conversions::to_string_t( "/health" )){
-			request.reply( status_codes::OK, "{}", "application/json; charset=utf-8" );
-		}else{
-			if( uri.path() == utility::conversions::to_string_t( "/forecasting" )){
-				auto		span = utils::newSpan( request, "forecasting" );
-				const auto	query = web::uri::split_query( uri.query() );
-
-				if( query.count( utility::conversions::to_string_t( "symbol" )) > 0  && query.count( utility::conversions::to_string_t( "value" )) > 0 ){
-					auto symbol = utility::conversions::to_utf8string( query.at( utility::conversions::to_string_t( "symbol" )));
-
-					const auto foreMaybe = getForecasting( symbol, std::stod( utility::conversions::to_utf8string( query.at( utility::conversions::to_string_t( "value" )) )));
-					if( foreMaybe ){
-						span->SetTag( "http.status_code", status_codes::OK );
-
-						mLogger->debug( "Forecasting for symbol {}: {}", symbol, foreMaybe.value() );
-						request.reply( status_codes::OK, fmt::format( "{{ \"value\": {} }}", foreMaybe.value() ), "application/json; charset=utf-8" );
-					}else{
-						span->SetTag( "error", true );
-						span->SetTag( "http.status_code", status_codes::NotFound );
-
-						mLogger->error( "No forecasting for symbol {}", symbol );
-						request.reply( status_codes::NotFound, "{}", "application/json; charset=utf-8" );
-					}
-				}else{
-					span->SetTag( "error", true );
-					span->SetTag( "http.status_code", status_codes::BadRequest );
-
-					mLogger->error( "Missing required parameters {}", utility::conversions::to_utf8string( uri.to_string() ));
-					request.reply( status_codes::BadRequest, "{}", "application/json; charset=utf-8" );
-				}
-				span->Finish();
+			const auto foreMaybe = getForecasting( symbol, std::stod( utility::conversions::to_utf8string( query.at( utility::conversions::to_string_t( "value" )) )));
+			if( foreMaybe ){
+				utils::setHTTPStatus( *span, status_codes::OK );
+
+				LOG_DEBUG( mLogger, "Forecasting for symbol {}: {}", symbol, foreMaybe.value() );
+				request.reply( status_codes::OK, fmt::format( "{{ \"value\": {} }}", foreMaybe.value() ), "application/json; charset=utf-8" );
 			}else{
-				mLogger->error( "Unknown route {}", utility::conversions::to_utf8string( uri.to_string() ));
+				utils::setHTTPStatus( *span, status_codes::NotFound );
+
+				LOG_LIMITED( mLogger, spdlog::level::err, "No forecasting for symbol {}", symbol );
 				request.reply( status_codes::NotFound, "{}", "application/json; charset=utf-8" );
 			}
+		}else{
+			utils::setHTTPStatus( *span, status_codes::BadRequest );
+
+			LOG_LIMITED( mLogger, spdlog::level::err, "Missing required parameters {}", utility::conversions::to_utf8string( uri.to_string() ));
+			request.reply( status_codes::BadRequest, "{}", "application/json; charset=utf-8" );
 		}
+		span->Finish();
 	}
 
-private:
 	std::optional<float> getForecasting( const std::string & symbol, float currentValue )
 	{
 		std::optional<float>	res;
@@ -85,9 +77,11 @@ int main( int argc, char * argv[])
 {
 	cxxopts::Options 	options( argv[0], "Forecaster service." );
 	int					port = 0;
-	bool				verbose = false;
-	std::string			logFile;
-	std::string			graylogHost;
+	utils::LoggerConfig	logConfig;
+	utils::SamplingConfig	samplingConfig;
+	utils::TracerConfig		tracerConfig;
+	utils::ThreadsConfig	threadsConfig;
+	int					drainMs = 0;
 	std::string			group;
 	std::string			appName = "forecaster";
 
@@ -95,12 +89,9 @@ int main( int argc, char * argv[])
 	 	.positional_help("[optional args]")
 		.show_positional_help();
 
+	utils::addCommonOptions( options, logConfig, samplingConfig, tracerConfig, threadsConfig, drainMs );
 	options.add_options()
 		("g,group", "service group", cxxopts::value<std::string>( group ) )
-		("help", "Print help")
-		("v,verbose", "Increase log level", cxxopts::value<bool>( verbose )->default_value("false") )
-		("log-file", "Log file", cxxopts::value<std::string>( logFile ) )
-		("graylog-host", "schema://host:port. Example: http://localhost:12201", cxxopts::value<std::string>( graylogHost ) )
 		("p,port", "Port", cxxopts::value<int>( port )->default_value( "16001" ) );
 
 	try{
@@ -113,13 +104,25 @@ int main( int argc, char * argv[])
     	spdlog::critical( "error parsing options: {}", e.what() );
     	exit(1);
 	}
+	utils::HTTPServer::startListeners( threadsConfig, logConfig );
+	utils::Shutdown::instance().block();
+	utils::HTTPServer::initThreads( threadsConfig );
 	consulcpp::Consul		consul;
 
 	if( consul.connect() ){
-		MyHTTPServer				server( utils::newLogger( appName, verbose, logFile, graylogHost ) );
+		MyHTTPServer				server( utils::newLogger( appName, logConfig ) );
 		consulcpp::Service			service;
 		consulcpp::ServiceCheck		check;
 
+		server.setTailLog( logConfig.mTail );
+		if( logConfig.mSampledDebug ){
+			server.setSampledLogLevel( spdlog::level::debug );
+		}
+		server.setSampling( samplingConfig );
+		server.setTracing( tracerConfig );
+		server.setThreads( threadsConfig );
+		server.setDrain( std::chrono::milliseconds( drainMs ));
+
 		service.mId = fmt::format( "{}_{}", appName, group );
 		service.mName = appName;
 		service.mAddress = consul.address();
@@ -133,8 +136,9 @@ int main( int argc, char * argv[])
 		service.mChecks = { check };
 
 		consul.services().create( service );
-		server.run( service.mName, service.mPort );
-		consul.services().destroy( service );	
+		server.run( service.mName, service.mPort, [ & ](){
+			consul.services().destroy( service );
+		});
 	}
 	return 0;
 }
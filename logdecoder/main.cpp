@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+// https://github.com/jarro2783/cxxopts
+#include <cxxopts.hpp>
+
+#include <fmt/args.h>
+#include <fmt/chrono.h>
+
+#include "../utils/binlog.h"
+
+using namespace utils;
+
+struct Site
+{
+	spdlog::level::level_enum	mLevel = spdlog::level::info;
+	std::string					mFile;
+	uint32_t					mLine = 0;
+	std::string					mFormat;
+};
+
+// Same layout as the pattern of text log files, %+%Q of newTraceFormatter: [%Y-%m-%d %H:%M:%S.%e] [%n] [%l] [%s:%#] %v%Q.
+// The source location is only known for the messages of a log statement, site.
+void printLine( std::ostream & out, const std::string & loggerName, spdlog::level::level_enum level, int64_t timeNs, std::string_view text,
+	std::pair<std::string_view, std::string_view> context = {}, const Site * site = nullptr )
+{
+	const std::time_t	seconds = static_cast<std::time_t>( timeNs / 1000000000 );
+	const int64_t		millis = ( timeNs / 1000000 ) % 1000;
+	const auto			levelName = spdlog::level::to_string_view( level );
+	std::string			location;
+	std::string			trace;
+
+	if( site && !site->mFile.empty() ){
+		const auto separator = site->mFile.find_last_of( "/\\" );
+
+		location = fmt::format( "[{}:{}] ", separator == std::string::npos ? site->mFile : site->mFile.substr( separator + 1 ), site->mLine );
+	}
+	if( !context.first.empty() ){
+		trace = fmt::format( " trace_id={} span_id={}", context.first, context.second );
+	}
+	out << fmt::format( "[{:%Y-%m-%d %H:%M:%S}.{:03}] [{}] [{}] {}{}{}\n", fmt::localtime( seconds ), millis, loggerName, std::string_view( levelName.data(), levelName.size() ), location, text, trace );
+}
+
+std::string formatMessage( const Site & site, const char *& in, const char * end )
+{
+	fmt::dynamic_format_arg_store<fmt::format_context>	args;
+
+	while( in < end ){
+		switch( binlog::get<binlog::ArgType>( in ))
+		{
+			case binlog::ArgType::Int :
+				args.push_back( binlog::get<int64_t>( in ));
+			break;
+
+			case binlog::ArgType::UInt :
+				args.push_back( binlog::get<uint64_t>( in ));
+			break;
+
+			case binlog::ArgType::Float :
+				args.push_back( binlog::get<float>( in ));
+			break;
+
+			case binlog::ArgType::Double :
+				args.push_back( binlog::get<double>( in ));
+			break;
+
+			case binlog::ArgType::Bool :
+				args.push_back( binlog::get<uint8_t>( in ) != 0 );
+			break;
+
+			case binlog::ArgType::Char :
+				args.push_back( binlog::get<char>( in ));
+			break;
+
+			case binlog::ArgType::String :
+				args.push_back( std::string( binlog::getString( in )));
+			break;
+
+			default:
+				return fmt::format( "<corrupted record of {}:{}>", site.mFile, site.mLine );
+		}
+	}
+	try{
+		return fmt::vformat( site.mFormat, args );
+	}catch( const fmt::format_error & e ){
+		return fmt::format( "<{} formatting \"{}\" of {}:{}>", e.what(), site.mFormat, site.mFile, site.mLine );
+	}
+}
+
+int main( int argc, char * argv[])
+{
+	cxxopts::Options 	options( argv[0], "Prints a binary log file as text." );
+	std::string			fileName;
+	bool				showSites = false;
+
+ 	options
+	 	.positional_help("file")
+		.show_positional_help();
+
+	options.add_options()
+		("help", "Print help")
+		("sites", "Print the log statements found in the file", cxxopts::value<bool>( showSites )->default_value("false") )
+		("file", "Binary log file", cxxopts::value<std::string>( fileName ) );
+
+	options.parse_positional({ "file" });
+
+	try{
+		const auto result = options.parse(argc, argv);
+		if( result.count( "help" ) > 0 || fileName.empty() ){
+			std::cout << options.help({ "" }) << std::endl;
+			exit(0);
+		}
+	}catch(const cxxopts::OptionException& e){
+		std::cerr << "error parsing options: " << e.what() << std::endl;
+		exit(1);
+	}
+
+	std::ifstream				file( fileName, std::ios::binary );
+	const std::vector<char>		data(( std::istreambuf_iterator<char>( file )), std::istreambuf_iterator<char>() );
+	binlog::FileHeader			header{};
+
+	if( data.size() < binlog::HeaderSize + binlog::SitesSize ){
+		std::cerr << fileName << " is not a binary log file" << std::endl;
+		exit(1);
+	}
+	std::memcpy( &header, data.data(), sizeof( header ));
+	if( std::memcmp( header.mMagic, binlog::Magic, sizeof( header.mMagic )) != 0 || header.mChunkSize != binlog::ChunkSize || data.size() < binlog::HeaderSize + binlog::SitesSize + header.mChunks * header.mChunkSize ){
+		std::cerr << fileName << " is not a binary log file" << std::endl;
+		exit(1);
+	}
+	const std::string			loggerName( header.mLoggerName, strnlen( header.mLoggerName, sizeof( header.mLoggerName )));
+	std::map<uint32_t, Site>	sites;
+	const char *				in = data.data() + binlog::HeaderSize;
+	const char *				sitesEnd = in + std::min<uint64_t>( header.mSitesUsed, binlog::SitesSize );
+
+	while( in < sitesEnd ){
+		const auto	id = binlog::get<uint32_t>( in );
+		Site		site;
+
+		site.mLevel = static_cast<spdlog::level::level_enum>( binlog::get<uint8_t>( in ));
+		site.mLine = binlog::get<uint32_t>( in );
+		site.mFile = binlog::getString( in );
+		site.mFormat = binlog::getString( in );
+		if( showSites ){
+			std::cout << fmt::format( "{}\t{}:{}\t{}\n", id, site.mFile, site.mLine, site.mFormat );
+		}
+		sites[ id ] = site;
+	}
+	if( showSites ){
+		exit(0);
+	}
+
+	// Chunks from the oldest to the newest
+	std::vector<std::pair<uint64_t, const char *>>	chunks;
+
+	for( uint64_t i = 0; i < header.mChunks; i++ ){
+		const char *	chunk = data.data() + binlog::HeaderSize + binlog::SitesSize + i * binlog::ChunkSize;
+		const auto		sequence = binlog::get<uint64_t>( chunk );
+
+		if( sequence > 0 ){
+			chunks.emplace_back( sequence, chunk );
+		}
+	}
+	std::sort( chunks.begin(), chunks.end() );
+
+	for( const auto & [ sequence, chunk ]: chunks ){
+		const char *	in = chunk;
+		const char *	chunkEnd = chunk - sizeof( binlog::ChunkHeader ) + binlog::ChunkSize;
+
+		while( in + sizeof( uint16_t ) <= chunkEnd ){
+			const char *	record = in;
+			const auto		size = binlog::get<uint16_t>( in );
+
+			if( size == 0 || record + size > chunkEnd ){
+				break;
+			}
+			const auto	type = binlog::get<binlog::RecordType>( in );
+
+			if( type == binlog::RecordType::Message ){
+				const auto	id = binlog::get<uint32_t>( in );
+				const auto	time = binlog::get<int64_t>( in );
+				const auto	context = binlog::getContext( in );
+				const auto	site = sites.find( id );
+
+				if( site != sites.end() ){
+					printLine( std::cout, loggerName, site->second.mLevel, time, formatMessage( site->second, in, record + size ), context, &site->second );
+				}else{
+					printLine( std::cout, loggerName, spdlog::level::err, time, fmt::format( "<unknown log statement {}>", id ), context );
+				}
+			}else if( type == binlog::RecordType::Text ){
+				const auto	level = static_cast<spdlog::level::level_enum>( binlog::get<uint8_t>( in ));
+				const auto	time = binlog::get<int64_t>( in );
+				const auto	context = binlog::getContext( in );
+
+				printLine( std::cout, loggerName, level, time, binlog::getString( in ), context );
+			}
+			in = record + size;
+		}
+	}
+	return 0;
+}
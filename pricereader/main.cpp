@@ -2,10 +2,10 @@
 #include <cxxopts.hpp>
 
 //
-#include <regex>
 #include <optional>
 #include <consulcpp/ConsulCpp>
 
+#include "../utils/options.h"
 #include "../utils/otutils.h"
 #include "../utils/server.h"
 
@@ -24,56 +24,49 @@ public:
 		if( mApiKey.empty() ){
 			logger->warn( "No API Key, we will use dummy data." );
 		}
+
+		static constexpr utils::Route<MyHTTPServer>	Routes[] = {
+			{ "/health", &MyHTTPServer::health },
+			{ "/value/{symbol}", &MyHTTPServer::readSymbol },
+		};
+		setRoutes( Routes );
 	}
 
-	void get( http_request & request ) override
+private:
+	std::string 	mApiKey;
+
+	void readSymbol( http_request & request, const utils::RouteParams & params )
 	{
-		const std::string 	uri = utility::conversions::to_utf8string( request.request_uri().to_string() );
+		if( !utils::isWord( params[0] )){
+			request.reply( status_codes::BadRequest, "{}", "application/json; charset=utf-8" );
+			return;
+		}
+		auto					span = utils::newSpan( request, "read-symbol" );
+		const std::string		symbol( params[0] );
+		std::optional<float> 	priceMaybe = getPrice( symbol, span->context() );
 
-		mLogger->debug( "{} {} from {}", utility::conversions::to_utf8string( request.method() ), uri, utility::conversions::to_utf8string( request.remote_address() ));
+		if( mApiKey.empty() ){
+			priceMaybe = getFakePrice( symbol, span->context() );
+		}else{
+			priceMaybe = getPrice( symbol, span->context() );
+		} 
+		if( priceMaybe ){
+			utils::setHTTPStatus( *span, status_codes::OK );
 
-		if( uri == "/health" ){
-			request.reply( status_codes::OK, "{}", "application/json; charset=utf-8" );
+			LOG_DEBUG( mLogger, "Price for symbol {}: {}", symbol, priceMaybe.value() );
+			request.reply( status_codes::OK, fmt::format( "{{ \"value\": {} }}", priceMaybe.value() ), "application/json; charset=utf-8" );
 		}else{
-			const std::regex 	rgx("/value/(\\w+)");
-			std::smatch			match;
-
-			if( std::regex_search( uri.begin(), uri.end(), match, rgx )){
-				auto					span = utils::newSpan( request, "read-symbol" );
-				const std::string		symbol = match[1];
-				std::optional<float> 	priceMaybe = getPrice( symbol, span->context() );
-
-				if( mApiKey.empty() ){
-					priceMaybe = getFakePrice( symbol, span->context() );
-				}else{
-					priceMaybe = getPrice( symbol, span->context() );
-				} 
-				if( priceMaybe ){
-					span->SetTag( "http.status_code", status_codes::OK );
-
-					mLogger->debug( "Price for symbol {}: {}", symbol, priceMaybe.value() );
-					request.reply( status_codes::OK, fmt::format( "{{ \"value\": {} }}", priceMaybe.value() ), "application/json; charset=utf-8" );
-				}else{
-					span->SetTag( "error", true );
-					span->SetTag( "http.status_code", status_codes::NotFound );
-
-					mLogger->error( "No price for symbol {}", symbol );
-					request.reply( status_codes::NotFound, "{}", "application/json; charset=utf-8" );
-				}
-				span->Finish();
-			}else{
-				mLogger->error( "Unknown route {}", uri );
-				request.reply( status_codes::NotFound, "{}", "application/json; charset=utf-8" );
-			}
+			utils::setHTTPStatus( *span, status_codes::NotFound );
+
+			LOG_LIMITED( mLogger, spdlog::level::err, "No price for symbol {}", symbol );
+			request.reply( status_codes::NotFound, "{}", "application/json; charset=utf-8" );
 		}
+		span->Finish();
 	}
 
-private:
-	std::string 	mApiKey;
-
 	std::optional<float> getFakePrice( const std::string & symbol, const opentracing::SpanContext & /*spanContext*/ )
 	{
-		mLogger->debug( "Reading last value for symbol {}", symbol );
+		LOG_DEBUG( mLogger, "Reading last value for symbol {}", symbol );
 
 		std::optional<float>	res;
 
@@ -89,7 +82,7 @@ private:
 
 	std::optional<float> getPrice( const std::string & symbol, const opentracing::SpanContext & spanContext )
 	{
-		mLogger->debug( "Reading last value for symbol {}", symbol );
+		LOG_DEBUG( mLogger, "Reading last value for symbol {}", symbol );
 
 		std::optional<float>	res;
 		const std::string 		query = fmt::format( "https://www.alphavantage.co/query?function=GLOBAL_QUOTE&symbol={}&apikey={}", symbol, mApiKey );
@@ -103,7 +96,7 @@ private:
 			if( response.status_code() == status_codes::OK ){
 				return response.extract_json();
 			}
-			mLogger->error( "Error accessing the symbol price. Nothing returned. Error: {}", response.status_code() );
+			LOG_LIMITED( mLogger, spdlog::level::err, "Error accessing the symbol price. Nothing returned. Error: {}", response.status_code() );
 			return pplx::task_from_result(json::value());
 		}).then([ &res, this ](pplx::task<json::value> previousTask){
 			try{
@@ -118,13 +111,13 @@ private:
 							res = std::stod( jsonValue.as_string() );
 						}
 					}else{
-						mLogger->error( "Error accessing the symbol price" );
+						LOG_LIMITED( mLogger, spdlog::level::err, "Error accessing the symbol price" );
 					}
 				}
 			}catch( const http_exception & e ){
-				mLogger->error( "Error accessing the symbol price {}", e.what() );
+				LOG_LIMITED( mLogger, spdlog::level::err, "Error accessing the symbol price {}", e.what() );
 			}catch(...){
-				mLogger->error( "Error accessing the symbol price" );
+				LOG_LIMITED( mLogger, spdlog::level::err, "Error accessing the symbol price" );
 			}
 		}).wait();
 
@@ -136,10 +129,12 @@ int main( int argc, char * argv[])
 {
 	cxxopts::Options 	options( argv[0], "Reads stock values." );
 	int					port = 0;
-	bool				verbose = false;
-	std::string			logFile;
 	std::string			apiKey;
-	std::string			graylogHost;
+	utils::LoggerConfig	logConfig;
+	utils::SamplingConfig	samplingConfig;
+	utils::TracerConfig		tracerConfig;
+	utils::ThreadsConfig	threadsConfig;
+	int					drainMs = 0;
 	std::string			group;
 	std::string			appName = "price-reader";
 
@@ -147,13 +142,10 @@ int main( int argc, char * argv[])
 	 	.positional_help("[optional args]")
 		.show_positional_help();
 
+	utils::addCommonOptions( options, logConfig, samplingConfig, tracerConfig, threadsConfig, drainMs );
 	options.add_options()
 		("g,group", "service group", cxxopts::value<std::string>( group ) )
-		("help", "Print help")
 		("api-key", "Alphavantage API Key", cxxopts::value<std::string>( apiKey ) )
-		("v,verbose", "Increase log level", cxxopts::value<bool>( verbose )->default_value("false") )
-		("log-file", "Log file", cxxopts::value<std::string>( logFile ) )
-		("graylog-host", "schema://host:port. Example: http://localhost:12201", cxxopts::value<std::string>( graylogHost ) )
 		("p,port", "Port", cxxopts::value<int>( port )->default_value( "16002" ) );
 
 	try{
@@ -166,13 +158,25 @@ int main( int argc, char * argv[])
     	spdlog::critical( "error parsing options: {}", e.what() );
     	exit(1);
 	}
+	utils::HTTPServer::startListeners( threadsConfig, logConfig );
+	utils::Shutdown::instance().block();
+	utils::HTTPServer::initThreads( threadsConfig );
 	consulcpp::Consul		consul;
 
 	if( consul.connect() ){
-		MyHTTPServer				server( apiKey, utils::newLogger( appName, verbose, logFile, graylogHost ) );
+		MyHTTPServer				server( apiKey, utils::newLogger( appName, logConfig ) );
 		consulcpp::Service			service;
 		consulcpp::ServiceCheck		check;
 
+		server.setTailLog( logConfig.mTail );
+		if( logConfig.mSampledDebug ){
+			server.setSampledLogLevel( spdlog::level::debug );
+		}
+		server.setSampling( samplingConfig );
+		server.setTracing( tracerConfig );
+		server.setThreads( threadsConfig );
+		server.setDrain( std::chrono::milliseconds( drainMs ));
+
 		service.mId = fmt::format( "{}_{}", appName, group );
 		service.mName = appName;
 		service.mAddress = consul.address();
@@ -186,8 +190,9 @@ int main( int argc, char * argv[])
 		service.mChecks = { check };
 
 		consul.services().create( service );
-		server.run( service.mName, service.mPort );
-		consul.services().destroy( service );	
+		server.run( service.mName, service.mPort, [ & ](){
+			consul.services().destroy( service );
+		});
 	}
 	return 0;
 }
@@ -0,0 +1,435 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <fmt/format.h>
+
+#include <spdlog/sinks/base_sink.h>
+
+#include "log_context.h"
+
+// Binary log: LOG_xxx statements store the id of their format string and their raw arguments, formatting
+// is done offline by logdecoder. The file is a ring of chunks, each one stamped with a sequence number so
+// the decoder can put them back in order after the ring wraps.
+//
+//   [ FileHeader | sites region | chunk 0 | chunk 1 | ... ]
+//
+// The sites region is the dictionary of format strings: { u32 id, u8 level, u32 line, u16 file length,
+// file, u16 format length, format }. Chunks hold records: { u16 size, u8 RecordType, ... }, a size of 0
+// ends the chunk. Records carry the trace context of the thread that logged them, see LogContext:
+// { u8 trace id length, trace id, u8 span id length, span id }, two zero bytes outside of a request.
+namespace utils {
+
+namespace binlog {
+
+static constexpr char		Magic[8] = { 'B', 'I', 'N', 'L', 'O', 'G', '0', '2' };
+static constexpr size_t		HeaderSize = 4096;
+static constexpr size_t		SitesSize = 256 * 1024;
+static constexpr size_t		ChunkSize = 64 * 1024;
+
+enum class RecordType : uint8_t {
+	End = 0,
+	Message = 1,	// u32 site id, i64 time (ns since epoch), trace context, arguments
+	Text = 2		// u8 level, i64 time, trace context, u16 length, text. Messages logged by spdlog directly.
+};
+
+enum class ArgType : uint8_t {
+	Int = 1,		// i64
+	UInt = 2,		// u64
+	Float = 3,
+	Double = 4,
+	Bool = 5,
+	Char = 6,
+	String = 7		// u16 length, bytes
+};
+
+struct FileHeader
+{
+	char		mMagic[8];
+	uint64_t	mChunkSize;
+	uint64_t	mChunks;
+	uint64_t	mSitesUsed;		// bytes used in the sites region
+	uint32_t	mSiteCount;
+	uint32_t	mReserved;
+	uint64_t	mLastSequence;	// sequence number of the last chunk started
+	char		mLoggerName[64];
+};
+
+struct ChunkHeader
+{
+	uint64_t	mSequence;		// 0: never written
+};
+
+// What fits in an empty chunk, before its end marker. Bigger messages are stored as truncated text.
+static constexpr size_t		MaxRecordSize = ChunkSize - sizeof( ChunkHeader ) - sizeof( uint16_t );
+
+// Little helpers shared by the writer and the decoder
+template<typename T>
+inline void put( char *& out, const T & value )
+{
+	std::memcpy( out, &value, sizeof( T ));
+	out += sizeof( T );
+}
+
+template<typename T>
+inline T get( const char *& in )
+{
+	T value;
+
+	std::memcpy( &value, in, sizeof( T ));
+	in += sizeof( T );
+	return value;
+}
+
+inline void putString( char *& out, std::string_view text )
+{
+	const uint16_t size = static_cast<uint16_t>( std::min<size_t>( text.size(), 0xffff ));
+
+	put( out, size );
+	std::memcpy( out, text.data(), size );
+	out += size;
+}
+
+inline std::string_view getString( const char *& in )
+{
+	const auto	size = get<uint16_t>( in );
+	const char *	data = in;
+
+	in += size;
+	return std::string_view( data, size );
+}
+
+inline size_t contextSize( const LogContext & context )
+{
+	return 2 + context.traceId().size() + context.spanId().size();
+}
+
+inline void putContext( char *& out, const LogContext & context )
+{
+	for( const auto id: { context.traceId(), context.spanId() }){
+		put( out, static_cast<uint8_t>( id.size() ));
+		std::memcpy( out, id.data(), id.size() );
+		out += id.size();
+	}
+}
+
+// Trace and span ids
+inline std::pair<std::string_view, std::string_view> getContext( const char *& in )
+{
+	std::string_view	ids[2];
+
+	for( auto & id: ids ){
+		const auto	size = get<uint8_t>( in );
+
+		id = std::string_view( in, size );
+		in += size;
+	}
+	return { ids[0], ids[1] };
+}
+
+// Types stored raw. Anything else is formatted to a string when logged.
+template<typename T>
+constexpr bool isRaw = std::is_arithmetic_v<T> || std::is_convertible_v<const T &, std::string_view>;
+
+template<typename T>
+inline std::conditional_t<isRaw<T>, const T &, std::string> normalize( const T & value )
+{
+	if constexpr( isRaw<T> ){
+		return value;
+	}else{
+		return fmt::format( "{}", value );
+	}
+}
+
+template<typename T>
+inline size_t argSize( const T & value )
+{
+	if constexpr( std::is_same_v<T, bool> || std::is_same_v<T, char> ){
+		return 2;
+	}else if constexpr( std::is_same_v<T, float> ){
+		return 1 + sizeof( float );
+	}else if constexpr( std::is_arithmetic_v<T> ){
+		return 1 + 8;
+	}else{
+		return 1 + sizeof( uint16_t ) + std::min<size_t>( std::string_view( value ).size(), 0xffff );
+	}
+}
+
+template<typename T>
+inline void putArg( char *& out, const T & value )
+{
+	if constexpr( std::is_same_v<T, bool> ){
+		put( out, ArgType::Bool );
+		put<uint8_t>( out, value ? 1 : 0 );
+	}else if constexpr( std::is_same_v<T, char> ){
+		put( out, ArgType::Char );
+		put( out, value );
+	}else if constexpr( std::is_same_v<T, float> ){
+		put( out, ArgType::Float );
+		put( out, value );
+	}else if constexpr( std::is_floating_point_v<T> ){
+		put( out, ArgType::Double );
+		put( out, static_cast<double>( value ));
+	}else if constexpr( std::is_integral_v<T> && std::is_signed_v<T> ){
+		put( out, ArgType::Int );
+		put( out, static_cast<int64_t>( value ));
+	}else if constexpr( std::is_integral_v<T> ){
+		put( out, ArgType::UInt );
+		put( out, static_cast<uint64_t>( value ));
+	}else{
+		put( out, ArgType::String );
+		putString( out, std::string_view( value ));
+	}
+}
+
+}
+
+// Static state of a LOG_xxx statement
+struct BinLogSite
+{
+	BinLogSite( spdlog::level::level_enum level, const char * file, int line, const char * format )
+		: mLevel( level )
+		, mFile( file )
+		, mLine( line )
+		, mFormat( format )
+	{
+	}
+
+	spdlog::level::level_enum	mLevel;
+	const char *				mFile;
+	int							mLine;
+	const char *				mFormat;
+	std::atomic<uint32_t>		mId{ 0 };		// 0 until registered in the binary log
+};
+
+class BinaryLog
+{
+public:
+	BinaryLog( const std::string & path, size_t maxBytes, const std::string & loggerName, spdlog::level::level_enum level )
+		: mLevel( level )
+	{
+		const size_t	chunks = std::max<size_t>( 2, ( maxBytes - std::min( maxBytes, binlog::HeaderSize + binlog::SitesSize )) / binlog::ChunkSize );
+		const size_t	fileSize = binlog::HeaderSize + binlog::SitesSize + chunks * binlog::ChunkSize;
+		bool			resume = false;
+		std::error_code	error;
+
+		if( std::filesystem::exists( path, error ) && std::filesystem::file_size( path, error ) == fileSize ){
+			binlog::FileHeader	header{};
+			std::ifstream		in( path, std::ios::binary );
+
+			in.read( reinterpret_cast<char *>( &header ), sizeof( header ));
+			resume = in && std::memcmp( header.mMagic, binlog::Magic, sizeof( header.mMagic )) == 0 && header.mChunks == chunks && header.mChunkSize == binlog::ChunkSize;
+		}
+		if( !resume ){
+			std::ofstream( path, std::ios::binary | std::ios::trunc );
+			std::filesystem::resize_file( path, fileSize );
+		}
+		mFile = boost::interprocess::file_mapping( path.c_str(), boost::interprocess::read_write );
+		mRegion = boost::interprocess::mapped_region( mFile, boost::interprocess::read_write );
+		mHeader = static_cast<binlog::FileHeader *>( mRegion.get_address() );
+		if( !resume ){
+			std::memcpy( mHeader->mMagic, binlog::Magic, sizeof( mHeader->mMagic ));
+			mHeader->mChunkSize = binlog::ChunkSize;
+			mHeader->mChunks = chunks;
+			mHeader->mSitesUsed = 0;
+			mHeader->mSiteCount = 0;
+			mHeader->mLastSequence = 0;
+		}else{
+			// Continue after the newest chunk of the previous run
+			for( size_t i = 0; i < chunks; i++ ){
+				if( chunk( i )->mSequence == mHeader->mLastSequence ){
+					mChunk = i;
+				}
+			}
+		}
+		std::memset( mHeader->mLoggerName, 0, sizeof( mHeader->mLoggerName ));
+		std::memcpy( mHeader->mLoggerName, loggerName.data(), std::min( loggerName.size(), sizeof( mHeader->mLoggerName ) - 1 ));
+		nextChunk();
+	}
+
+	~BinaryLog()
+	{
+		if( sActive == this ){
+			sActive = nullptr;
+		}
+		mRegion.flush( 0, 0, true );
+	}
+
+	// The binary log used by the LOG_xxx macros, kept alive until another one is activated
+	static void activate( std::shared_ptr<BinaryLog> binaryLog )
+	{
+		sActive = binaryLog.get();
+		sOwner = binaryLog;
+	}
+
+	// The active binary log if it records messages of this level
+	static BinaryLog * enabled( spdlog::level::level_enum level )
+	{
+		BinaryLog * res = sActive.load( std::memory_order_relaxed );
+
+		return res && level >= res->mLevel ? res : nullptr;
+	}
+
+	template<typename... Args>
+	void write( BinLogSite & site, const Args &... args )
+	{
+		writeNormalized( site, binlog::normalize( args )... );
+	}
+
+	void writeText( spdlog::level::level_enum level, std::chrono::system_clock::time_point time, std::string_view text )
+	{
+		const LogContext &	context = LogContext::current();
+
+		text = text.substr( 0, binlog::MaxRecordSize - 64 - binlog::contextSize( context ));
+
+		std::lock_guard<std::mutex>	lock( mMutex );
+		const size_t				size = sizeof( uint16_t ) + 2 + sizeof( int64_t ) + binlog::contextSize( context ) + sizeof( uint16_t ) + text.size();
+		char *						out = reserve( size );
+
+		binlog::put( out, static_cast<uint16_t>( size ));
+		binlog::put( out, binlog::RecordType::Text );
+		binlog::put( out, static_cast<uint8_t>( level ));
+		binlog::put( out, static_cast<int64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>( time.time_since_epoch() ).count() ));
+		binlog::putContext( out, context );
+		binlog::putString( out, text );
+	}
+
+	// Set while spdlog delivers a message already written by a LOG_xxx statement, so binary_log_sink skips it
+	static inline thread_local bool tSkipText = false;
+
+private:
+	static inline std::atomic<BinaryLog *>	sActive{ nullptr };
+	static inline std::shared_ptr<BinaryLog>	sOwner;
+
+	spdlog::level::level_enum				mLevel;
+	boost::interprocess::file_mapping		mFile;
+	boost::interprocess::mapped_region		mRegion;
+	binlog::FileHeader *					mHeader = nullptr;
+	size_t									mChunk = 0;
+	size_t									mChunkUsed = 0;
+	std::mutex								mMutex;
+
+	binlog::ChunkHeader * chunk( size_t index ) const
+	{
+		return reinterpret_cast<binlog::ChunkHeader *>( reinterpret_cast<char *>( mHeader ) + binlog::HeaderSize + binlog::SitesSize + index * binlog::ChunkSize );
+	}
+
+	void nextChunk()
+	{
+		mChunk = ( mChunk + 1 ) % mHeader->mChunks;
+		chunk( mChunk )->mSequence = 0;
+		std::memset( chunk( mChunk ) + 1, 0, sizeof( uint16_t ));
+		chunk( mChunk )->mSequence = ++mHeader->mLastSequence;
+		mChunkUsed = sizeof( binlog::ChunkHeader );
+	}
+
+	// Space for a record in the current chunk. Must hold mMutex.
+	char * reserve( size_t size )
+	{
+		if( mChunkUsed + size + sizeof( uint16_t ) > binlog::ChunkSize ){
+			nextChunk();
+		}
+		char * res = reinterpret_cast<char *>( chunk( mChunk )) + mChunkUsed;
+
+		mChunkUsed += size;
+		// End of chunk marker, overwritten by the next record
+		std::memset( res + size, 0, sizeof( uint16_t ));
+
+		return res;
+	}
+
+	// Adds the site to the dictionary. Returns 0 if the dictionary is full.
+	uint32_t registerSite( BinLogSite & site )
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+		uint32_t					res = site.mId;
+
+		if( res == 0 ){
+			const std::string_view	file( site.mFile );
+			const std::string_view	format( site.mFormat );
+			const size_t			size = sizeof( uint32_t ) + 1 + sizeof( uint32_t ) + 2 * sizeof( uint16_t ) + file.size() + format.size();
+
+			if( mHeader->mSitesUsed + size <= binlog::SitesSize && file.size() < 0xffff && format.size() < 0xffff ){
+				char * out = reinterpret_cast<char *>( mHeader ) + binlog::HeaderSize + mHeader->mSitesUsed;
+
+				res = mHeader->mSiteCount + 1;
+				binlog::put( out, res );
+				binlog::put( out, static_cast<uint8_t>( site.mLevel ));
+				binlog::put( out, static_cast<uint32_t>( site.mLine ));
+				binlog::putString( out, file );
+				binlog::putString( out, format );
+				mHeader->mSitesUsed += size;
+				mHeader->mSiteCount = res;
+				site.mId = res;
+			}
+		}
+		return res;
+	}
+
+	template<typename... Args>
+	void writeNormalized( BinLogSite & site, const Args &... args )
+	{
+		uint32_t			id = site.mId.load( std::memory_order_relaxed );
+		const auto			now = std::chrono::system_clock::now();
+		const LogContext &	context = LogContext::current();
+
+		if( id == 0 ){
+			id = registerSite( site );
+		}
+		const size_t	size = sizeof( uint16_t ) + 1 + sizeof( uint32_t ) + sizeof( int64_t ) + binlog::contextSize( context ) + ( binlog::argSize( args ) + ... + 0 );
+
+		if( id == 0 || size > binlog::MaxRecordSize ){
+			writeText( site.mLevel, now, fmt::format( fmt::runtime( site.mFormat ), args... ));
+			return;
+		}
+
+		std::lock_guard<std::mutex>	lock( mMutex );
+		char *						out = reserve( size );
+
+		binlog::put( out, static_cast<uint16_t>( size ));
+		binlog::put( out, binlog::RecordType::Message );
+		binlog::put( out, id );
+		binlog::put( out, static_cast<int64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>( now.time_since_epoch() ).count() ));
+		binlog::putContext( out, context );
+		( binlog::putArg( out, args ), ... );
+	}
+};
+
+// Stores messages logged through spdlog, not through the LOG_xxx macros, as preformatted text
+template<typename Mutex>
+class binary_log_sink : public spdlog::sinks::base_sink<Mutex>
+{
+public:
+	explicit binary_log_sink( std::shared_ptr<BinaryLog> binaryLog ) : mBinaryLog( binaryLog ) {}
+
+protected:
+	void sink_it_( const spdlog::details::log_msg & msg ) override
+	{
+		if( !BinaryLog::tSkipText ){
+			mBinaryLog->writeText( msg.level, msg.time, std::string_view( msg.payload.data(), msg.payload.size() ));
+		}
+	}
+
+	void flush_() override
+	{
+	}
+
+private:
+	std::shared_ptr<BinaryLog>	mBinaryLog;
+};
+
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace utils {
+
+// Bounded lock-free multi producer queue (Dmitry Vyukov's array of cells tagged with a sequence number).
+// Producers never block: tryPush fails when the queue is full. The single consumer can sleep in wait()
+// when the queue is empty; producers only take the mutex to wake it up if it is sleeping.
+template<typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue( size_t capacity )
+	{
+		size_t size = 2;
+
+		while( size < capacity ){
+			size *= 2;
+		}
+		mMask = size - 1;
+		mCells = std::make_unique<Cell[]>( size );
+		for( size_t i = 0; i < size; i++ ){
+			mCells[ i ].mSequence.store( i, std::memory_order_relaxed );
+		}
+	}
+
+	bool tryPush( T && item )
+	{
+		Cell *	cell = nullptr;
+		size_t	pos = mTail.load( std::memory_order_relaxed );
+
+		for( ;; ){
+			cell = &mCells[ pos & mMask ];
+			const size_t	sequence = cell->mSequence.load( std::memory_order_acquire );
+			const intptr_t	diff = static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( pos );
+
+			if( diff == 0 ){
+				if( mTail.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed )){
+					break;
+				}
+			}else if( diff < 0 ){
+				return false;
+			}else{
+				pos = mTail.load( std::memory_order_relaxed );
+			}
+		}
+		cell->mItem = std::move( item );
+		cell->mSequence.store( pos + 1, std::memory_order_release );
+		// Pairs with the fence in wait(): either the consumer sees the item or this sees it sleeping
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		if( mSleeping.load( std::memory_order_relaxed )){
+			std::lock_guard<std::mutex>	lock( mMutex );
+
+			mWakeUp.notify_one();
+		}
+		return true;
+	}
+
+	bool tryPop( T & item )
+	{
+		Cell *	cell = nullptr;
+		size_t	pos = mHead.load( std::memory_order_relaxed );
+
+		for( ;; ){
+			cell = &mCells[ pos & mMask ];
+			const size_t	sequence = cell->mSequence.load( std::memory_order_acquire );
+			const intptr_t	diff = static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( pos + 1 );
+
+			if( diff == 0 ){
+				if( mHead.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed )){
+					break;
+				}
+			}else if( diff < 0 ){
+				return false;
+			}else{
+				pos = mHead.load( std::memory_order_relaxed );
+			}
+		}
+		item = std::move( cell->mItem );
+		cell->mItem = T();
+		cell->mSequence.store( pos + mMask + 1, std::memory_order_release );
+
+		return true;
+	}
+
+	bool empty() const
+	{
+		return size() == 0;
+	}
+
+	size_t size() const
+	{
+		const size_t tail = mTail.load( std::memory_order_relaxed );
+		const size_t head = mHead.load( std::memory_order_relaxed );
+
+		return tail > head ? tail - head : 0;
+	}
+
+	// Consumer side: sleeps until something is pushed, wakeUp() is called or the timeout expires
+	void wait( std::chrono::milliseconds timeout )
+	{
+		// A short spin first: waking a sleeping consumer costs the producer a system call
+		for( int i = 0; i < SpinCount; i++ ){
+			if( !empty() ){
+				return;
+			}
+			std::this_thread::yield();
+		}
+		std::unique_lock<std::mutex>	lock( mMutex );
+
+		mSleeping.store( true, std::memory_order_relaxed );
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		if( empty() && !mWakeUpRequested ){
+			mWakeUp.wait_for( lock, timeout );
+		}
+		mWakeUpRequested = false;
+		mSleeping.store( false, std::memory_order_relaxed );
+	}
+
+	void wakeUp()
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		mWakeUpRequested = true;
+		mWakeUp.notify_one();
+	}
+
+private:
+	static constexpr int	SpinCount = 64;
+
+	struct Cell
+	{
+		std::atomic<size_t>	mSequence;
+		T					mItem;
+	};
+
+	std::unique_ptr<Cell[]>			mCells;
+	size_t							mMask = 0;
+	alignas( 64 ) std::atomic<size_t>	mTail{ 0 };
+	alignas( 64 ) std::atomic<size_t>	mHead{ 0 };
+	alignas( 64 ) std::atomic<bool>	mSleeping{ false };
+	bool							mWakeUpRequested = false;
+	std::mutex						mMutex;
+	std::condition_variable			mWakeUp;
+};
+
+}
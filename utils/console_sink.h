@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/sink.h>
+#include <spdlog/pattern_formatter.h>
+
+namespace utils {
+
+// Colored stdout sink for many logging threads. Each thread formats into its own staging buffer, guarded by
+// a mutex that only the writer thread competes for. The writer merges the staged lines of all threads in
+// time order and writes them with a single write(2) every interval, or earlier when a buffer fills up. A thread
+// that logs faster than the writer drains its own buffer past MaxStagingBytes.
+class console_sink : public spdlog::sinks::sink
+{
+public:
+	explicit console_sink( std::chrono::milliseconds interval = std::chrono::milliseconds( 50 ), int fd = 1 )
+		: mFd( fd )
+		, mInterval( interval )
+		, mColors( isTerminal( fd ))
+		, mFormatter( std::make_unique<spdlog::pattern_formatter>() )
+	{
+		mWriter = std::thread( &console_sink::realRun, this );
+	}
+
+	~console_sink() override
+	{
+		{
+			std::lock_guard<std::mutex>	lock( mWakeUpMutex );
+
+			mRunThread = false;
+		}
+		mWakeUp.notify_one();
+		mWriter.join();
+		drain();
+	}
+
+	void log( const spdlog::details::log_msg & msg ) override
+	{
+		if( !should_log( msg.level )){
+			return;
+		}
+		Staging &	staging = threadStaging();
+		size_t		staged;
+
+		{
+			std::lock_guard<std::mutex>		lock( staging.mMutex );
+
+			staged = stage( staging, msg );
+		}
+		if( staged >= MaxStagingBytes ){
+			drain();
+		}else if( staged >= FlushBytes ){
+			mWakeUp.notify_one();
+		}
+	}
+
+	// Writes what has been logged so far from every thread
+	void flush() override
+	{
+		drain();
+	}
+
+	void set_pattern( const std::string & pattern ) override
+	{
+		set_formatter( std::make_unique<spdlog::pattern_formatter>( pattern ));
+	}
+
+	void set_formatter( std::unique_ptr<spdlog::formatter> formatter ) override
+	{
+		std::lock_guard<std::mutex>	lock( mFormatterMutex );
+
+		mFormatter = std::move( formatter );
+		mFormatterVersion++;
+	}
+
+private:
+	static constexpr size_t				FlushBytes = 64 * 1024;
+	static constexpr size_t				MaxStagingBytes = 4 * FlushBytes;
+	static constexpr std::string_view	Reset = "\033[m";
+
+	struct Line
+	{
+		spdlog::log_clock::time_point	mTime;
+		size_t							mBegin;
+		size_t							mEnd;
+	};
+
+	struct Staging
+	{
+		std::mutex							mMutex;
+		fmt::memory_buffer					mText;
+		std::vector<Line>					mLines;
+		spdlog::memory_buf_t				mFormatted;
+		std::unique_ptr<spdlog::formatter>	mFormatter;
+		unsigned							mFormatterVersion = 0;
+	};
+
+	// Formats msg into the staging buffer, locked by the caller. Returns the bytes staged.
+	size_t stage( Staging & staging, const spdlog::details::log_msg & msg )
+	{
+		spdlog::memory_buf_t &	formatted = staging.mFormatted;
+
+		if( staging.mFormatterVersion != mFormatterVersion ){
+			std::lock_guard<std::mutex>	formatterLock( mFormatterMutex );
+
+			staging.mFormatter = mFormatter->clone();
+			staging.mFormatterVersion = mFormatterVersion;
+		}
+		formatted.clear();
+		staging.mFormatter->format( msg, formatted );
+
+		const size_t	begin = staging.mText.size();
+
+		if( mColors && msg.color_range_end > msg.color_range_start ){
+			const std::string_view	color = levelColor( msg.level );
+
+			staging.mText.append( formatted.data(), formatted.data() + msg.color_range_start );
+			staging.mText.append( color.data(), color.data() + color.size() );
+			staging.mText.append( formatted.data() + msg.color_range_start, formatted.data() + msg.color_range_end );
+			staging.mText.append( Reset.data(), Reset.data() + Reset.size() );
+			staging.mText.append( formatted.data() + msg.color_range_end, formatted.data() + formatted.size() );
+		}else{
+			staging.mText.append( formatted.data(), formatted.data() + formatted.size() );
+		}
+		staging.mLines.push_back({ msg.time, begin, staging.mText.size() });
+		return staging.mText.size();
+	}
+
+	// What the writer took from a staging buffer
+	struct Batch
+	{
+		fmt::memory_buffer	mText;
+		std::vector<Line>	mLines;
+	};
+
+	const int								mFd;
+	const std::chrono::milliseconds			mInterval;
+	const bool								mColors;
+	const uint64_t							mId = sNextId++;
+	std::unique_ptr<spdlog::formatter>		mFormatter;
+	std::atomic<unsigned>					mFormatterVersion{ 1 };
+	std::mutex								mFormatterMutex;
+	std::vector<std::shared_ptr<Staging>>	mStagings;
+	std::mutex								mStagingsMutex;
+	std::vector<Batch>						mBatches;
+	std::vector<std::pair<size_t, size_t>>	mOrder;			// batch and line, in time order
+	fmt::memory_buffer						mOut;
+	std::mutex								mDrainMutex;
+	std::thread								mWriter;
+	bool									mRunThread = true;
+	std::mutex								mWakeUpMutex;
+	std::condition_variable					mWakeUp;
+
+	static inline std::atomic<uint64_t>		sNextId{ 1 };
+
+	static std::string_view levelColor( spdlog::level::level_enum level )
+	{
+		switch( level )
+		{
+			case spdlog::level::trace :		return "\033[37m";
+			case spdlog::level::debug :		return "\033[36m";
+			case spdlog::level::info :		return "\033[32m";
+			case spdlog::level::warn :		return "\033[33m\033[1m";
+			case spdlog::level::err :		return "\033[31m\033[1m";
+			case spdlog::level::critical :	return "\033[1m\033[41m";
+			default:						return "";
+		}
+	}
+
+	// The staging buffer of the calling thread, created on its first message
+	Staging & threadStaging()
+	{
+		// Keyed by sink id: a new sink may reuse the address of a destroyed one
+		static thread_local std::vector<std::pair<uint64_t, std::shared_ptr<Staging>>>	tStagings;
+
+		for( const auto & [ id, staging ]: tStagings ){
+			if( id == mId ){
+				return *staging;
+			}
+		}
+		auto staging = std::make_shared<Staging>();
+
+		tStagings.emplace_back( mId, staging );
+		{
+			std::lock_guard<std::mutex>	lock( mStagingsMutex );
+
+			mStagings.push_back( staging );
+		}
+		return *staging;
+	}
+
+	void realRun()
+	{
+		std::unique_lock<std::mutex>	lock( mWakeUpMutex );
+
+		while( mRunThread ){
+			mWakeUp.wait_for( lock, mInterval );
+			lock.unlock();
+			drain();
+			lock.lock();
+		}
+	}
+
+	void drain()
+	{
+		std::lock_guard<std::mutex>				drainLock( mDrainMutex );
+		std::vector<std::shared_ptr<Staging>>	stagings;
+
+		{
+			std::lock_guard<std::mutex>	lock( mStagingsMutex );
+
+			// Buffers only referenced from here belong to threads that have finished
+			mStagings.erase( std::remove_if( mStagings.begin(), mStagings.end(), []( const auto & staging ){
+				std::lock_guard<std::mutex>	stagingLock( staging->mMutex );
+
+				return staging.use_count() == 1 && staging->mLines.empty();
+			}), mStagings.end() );
+			stagings = mStagings;
+		}
+		mBatches.resize( std::max( mBatches.size(), stagings.size() ));
+		mOrder.clear();
+
+		for( size_t i = 0; i < stagings.size(); i++ ){
+			Batch &	batch = mBatches[ i ];
+
+			batch.mText.clear();
+			batch.mLines.clear();
+			{
+				std::lock_guard<std::mutex>	lock( stagings[ i ]->mMutex );
+
+				std::swap( batch.mText, stagings[ i ]->mText );
+				std::swap( batch.mLines, stagings[ i ]->mLines );
+			}
+			for( size_t j = 0; j < batch.mLines.size(); j++ ){
+				mOrder.emplace_back( i, j );
+			}
+		}
+		if( mOrder.empty() ){
+			return;
+		}
+		std::stable_sort( mOrder.begin(), mOrder.end(), [ this ]( const auto & a, const auto & b ){
+			return mBatches[ a.first ].mLines[ a.second ].mTime < mBatches[ b.first ].mLines[ b.second ].mTime;
+		});
+		mOut.clear();
+		for( const auto & [ i, j ]: mOrder ){
+			const Line &	line = mBatches[ i ].mLines[ j ];
+
+			mOut.append( mBatches[ i ].mText.data() + line.mBegin, mBatches[ i ].mText.data() + line.mEnd );
+		}
+		write( mOut.data(), mOut.size() );
+	}
+
+	static bool isTerminal( int fd )
+	{
+#ifdef _WIN32
+		return _isatty( fd ) != 0;
+#else
+		return isatty( fd ) == 1;
+#endif
+	}
+
+	void write( const char * data, size_t size )
+	{
+		while( size > 0 ){
+#ifdef _WIN32
+			const int written = _write( mFd, data, static_cast<unsigned>( std::min<size_t>( size, INT_MAX )));
+#else
+			const ssize_t written = ::write( mFd, data, size );
+#endif
+
+			if( written < 0 ){
+				if( errno == EINTR ){
+					continue;
+				}
+				return;
+			}
+			data += written;
+			size -= written;
+		}
+	}
+};
+
+}
@@ -0,0 +1,335 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/sink.h>
+
+#include "bounded_queue.h"
+#include "binlog.h"
+#include "log_context.h"
+#include "log_metrics.h"
+
+namespace utils {
+
+// Writes each sink from its own thread so a slow sink can not delay the others, or the caller.
+// The caller copies the message once into a lock-free queue; a dispatcher thread hands it to the bounded
+// lock-free queue of every sink. A sink whose queue is full loses the message, and only that sink, unless it
+// is an error: errors wait for room instead. Messages are recycled, so logging allocates nothing once the
+// pool has grown to the messages in flight. Losses are counted in stats and logged every ReportInterval.
+class fanout_sink : public spdlog::sinks::sink
+{
+public:
+	static constexpr spdlog::level::level_enum	KeepLevel = spdlog::level::err;		// never dropped
+	static constexpr std::chrono::seconds		ReportInterval{ 10 };
+	static constexpr std::chrono::seconds		FlushTimeout{ 5 };
+
+	// sinks are pairs of name, used in the stats, and sink
+	fanout_sink( const std::vector<std::pair<std::string, spdlog::sink_ptr>> & sinks, size_t queueSize )
+		: mQueue( queueSize )
+		, mFree( queueSize * ( sinks.size() + 1 ))
+	{
+		for( const auto & [ name, sink ]: sinks ){
+			mLanes.push_back( std::make_unique<Lane>( name, sink, queueSize ));
+		}
+		for( auto & lane: mLanes ){
+			lane->mThread = std::thread( &fanout_sink::runLane, this, lane.get() );
+		}
+		mDispatcher = std::thread( &fanout_sink::runDispatcher, this );
+	}
+
+	~fanout_sink() override
+	{
+		mRunDispatcher = false;
+		mQueue.wakeUp();
+		mDispatcher.join();
+		for( auto & lane: mLanes ){
+			lane->mRun = false;
+			lane->mQueue.wakeUp();
+			lane->mThread.join();
+		}
+		Message * message = nullptr;
+
+		while( mFree.tryPop( message )){
+			delete message;
+		}
+	}
+
+	void log( const spdlog::details::log_msg & msg ) override
+	{
+		Message * message = nullptr;
+
+		if( !mFree.tryPop( message )){
+			message = new Message();
+		}
+		message->assign( msg, BinaryLog::tSkipText );
+		while( !mQueue.tryPush( std::move( message ))){
+			if( msg.level < KeepLevel ){
+				mDropped++;
+				release( message );
+				return;
+			}
+			std::this_thread::yield();
+		}
+	}
+
+	// Waits, up to FlushTimeout, until every sink has written the messages queued before the call and has
+	// been flushed
+	void flush() override
+	{
+		std::unique_lock<std::mutex>	lock( mFlushMutex );
+		const uint64_t					ticket = ++mFlushes;
+
+		lock.unlock();
+		while( !mQueue.tryPush( nullptr )){
+			std::this_thread::yield();
+		}
+		lock.lock();
+		mFlushed.wait_for( lock, FlushTimeout, [ this, ticket ]{
+			return std::all_of( mLanes.begin(), mLanes.end(), [ ticket ]( const auto & lane ){ return lane->mFlushes >= ticket; });
+		});
+	}
+
+	// The sinks are not synchronized with their threads: set the pattern before logging
+	void set_pattern( const std::string & pattern ) override
+	{
+		for( auto & lane: mLanes ){
+			lane->mSink->set_pattern( pattern );
+		}
+	}
+
+	void set_formatter( std::unique_ptr<spdlog::formatter> formatter ) override
+	{
+		for( auto & lane: mLanes ){
+			lane->mSink->set_formatter( formatter->clone() );
+		}
+	}
+
+	FanoutStats stats() const
+	{
+		FanoutStats	res;
+
+		res.mDropped = mDropped;
+		for( const auto & lane: mLanes ){
+			SinkStats		stats;
+			const uint64_t	logged = lane->mLogged;
+
+			stats.mName = lane->mName;
+			stats.mLogged = logged;
+			stats.mDropped = lane->mDropped;
+			stats.mQueueDepth = lane->mQueue.size();
+			if( logged > 0 ){
+				stats.mAvgQueueMs = lane->mQueueNs / 1e6 / logged;
+				stats.mAvgLogUs = lane->mLogNs / 1e3 / logged;
+			}
+			stats.mMaxQueueMs = lane->mMaxQueueNs / 1e6;
+			stats.mMaxLogUs = lane->mMaxLogNs / 1e3;
+			res.mSinks.push_back( stats );
+		}
+		return res;
+	}
+
+private:
+	// A copy of the log_msg, its texts in a buffer that keeps its capacity when the message is reused
+	struct Message
+	{
+		void assign( const spdlog::details::log_msg & msg, bool skipBinaryLog )
+		{
+			mText.clear();
+			mText.append( msg.logger_name.data(), msg.logger_name.data() + msg.logger_name.size() );
+			mText.append( msg.payload.data(), msg.payload.data() + msg.payload.size() );
+			mNameSize = msg.logger_name.size();
+			mLevel = msg.level;
+			mTime = msg.time;
+			mSource = msg.source;
+			mThreadId = msg.thread_id;
+			mSkipBinaryLog = skipBinaryLog;
+			mContext = LogContext::current();
+			mRefs.store( 1, std::memory_order_relaxed );
+		}
+
+		spdlog::details::log_msg msg() const
+		{
+			spdlog::details::log_msg	res( mTime, mSource, spdlog::string_view_t( mText.data(), mNameSize ), mLevel,
+				spdlog::string_view_t( mText.data() + mNameSize, mText.size() - mNameSize ));
+
+			res.thread_id = mThreadId;
+			return res;
+		}
+
+		fmt::memory_buffer				mText;			// logger name and payload
+		size_t							mNameSize = 0;
+		spdlog::level::level_enum		mLevel = spdlog::level::off;
+		spdlog::log_clock::time_point	mTime;
+		spdlog::source_loc				mSource;
+		size_t							mThreadId = 0;
+		bool							mSkipBinaryLog = false;
+		LogContext						mContext;		// of the thread that logged it
+		std::atomic<uint32_t>			mRefs{ 0 };		// queues holding it
+	};
+
+	// nullptr asks for a flush
+	using MessagePtr = Message *;
+
+	struct Lane
+	{
+		Lane( const std::string & name, spdlog::sink_ptr sink, size_t queueSize )
+			: mSink( sink )
+			, mName( name )
+			, mQueue( queueSize )
+		{
+		}
+
+		spdlog::sink_ptr			mSink;
+		std::string					mName;
+		BoundedQueue<MessagePtr>	mQueue;
+		std::thread					mThread;
+		std::atomic<bool>			mRun{ true };
+		std::atomic<uint64_t>		mLogged{ 0 };
+		std::atomic<uint64_t>		mDropped{ 0 };
+		std::atomic<uint64_t>		mQueueNs{ 0 };
+		std::atomic<uint64_t>		mMaxQueueNs{ 0 };
+		std::atomic<uint64_t>		mLogNs{ 0 };
+		std::atomic<uint64_t>		mMaxLogNs{ 0 };
+		uint64_t					mFlushes = 0;		// flush markers done, guarded by mFlushMutex
+	};
+
+	BoundedQueue<MessagePtr>			mQueue;
+	BoundedQueue<MessagePtr>			mFree;			// messages to reuse
+	std::vector<std::unique_ptr<Lane>>	mLanes;
+	std::thread							mDispatcher;
+	std::atomic<bool>					mRunDispatcher{ true };
+	std::mutex							mFlushMutex;
+	std::condition_variable				mFlushed;
+	uint64_t							mFlushes = 0;		// flush markers queued
+	std::atomic<uint64_t>				mDropped{ 0 };
+
+	void release( Message * message )
+	{
+		if( message->mRefs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 && !mFree.tryPush( std::move( message ))){
+			delete message;
+		}
+	}
+
+	void runDispatcher()
+	{
+		MessagePtr	message = nullptr;
+		auto		nextReport = std::chrono::steady_clock::now() + ReportInterval;
+		uint64_t	reported = 0;
+
+		while( mRunDispatcher || !mQueue.empty() ){
+			if( mQueue.tryPop( message )){
+				if( !message ){
+					// Never dropped, flush() waits for them
+					for( auto & lane: mLanes ){
+						while( !lane->mQueue.tryPush( nullptr )){
+							std::this_thread::yield();
+						}
+					}
+				}else{
+					for( auto & lane: mLanes ){
+						if( lane->mSink->should_log( message->mLevel )){
+							message->mRefs.fetch_add( 1, std::memory_order_relaxed );
+							while( !lane->mQueue.tryPush( std::move( message ))){
+								if( message->mLevel < KeepLevel ){
+									message->mRefs.fetch_sub( 1, std::memory_order_relaxed );
+									lane->mDropped++;
+									break;
+								}
+								std::this_thread::yield();
+							}
+						}
+					}
+					release( message );
+				}
+			}else{
+				mQueue.wait( std::chrono::milliseconds( 100 ));
+			}
+			if( const auto now = std::chrono::steady_clock::now(); now >= nextReport ){
+				nextReport = now + ReportInterval;
+				reported = reportDropped( reported );
+			}
+		}
+	}
+
+	// Logs the messages lost since the last report, which counted reported of them
+	uint64_t reportDropped( uint64_t reported ) const
+	{
+		const FanoutStats	stats = this->stats();
+		uint64_t			res = stats.mDropped;
+		std::string			sinks;
+
+		for( const auto & sink: stats.mSinks ){
+			res += sink.mDropped;
+			if( sink.mDropped > 0 ){
+				fmt::format_to( std::back_inserter( sinks ), " {} {}", sink.mName, sink.mDropped );
+			}
+		}
+		if( res > reported ){
+			spdlog::warn( "Log sinks full, {} messages lost in the last {} seconds. Since the start: all {}{}", res - reported, ReportInterval.count(), stats.mDropped, sinks );
+		}
+		return res;
+	}
+
+	void runLane( Lane * lane )
+	{
+		MessagePtr	message = nullptr;
+
+		while( lane->mRun || !lane->mQueue.empty() ){
+			if( lane->mQueue.tryPop( message )){
+				try{
+					if( message ){
+						const auto	start = std::chrono::steady_clock::now();
+						const auto	queueNs = std::chrono::duration_cast<std::chrono::nanoseconds>( spdlog::log_clock::now() - message->mTime ).count();
+
+						BinaryLog::tSkipText = message->mSkipBinaryLog;
+						{
+							LogContext::Scope	scope( message->mContext );
+
+							lane->mSink->log( message->msg() );
+						}
+						BinaryLog::tSkipText = false;
+
+						const auto	logNs = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+
+						lane->mLogged++;
+						if( queueNs > 0 ){
+							lane->mQueueNs += queueNs;
+							lane->mMaxQueueNs = std::max<uint64_t>( lane->mMaxQueueNs, queueNs );
+						}
+						lane->mLogNs += logNs;
+						lane->mMaxLogNs = std::max<uint64_t>( lane->mMaxLogNs, logNs );
+					}else{
+						lane->mSink->flush();
+					}
+				}catch( const std::exception & e ){
+					spdlog::error( "Error writting to log sink {}: {}", lane->mName, e.what() );
+				}
+				if( message ){
+					release( message );
+				}else{
+					std::lock_guard<std::mutex>	lock( mFlushMutex );
+
+					lane->mFlushes++;
+					mFlushed.notify_all();
+				}
+			}else{
+				lane->mQueue.wait( std::chrono::milliseconds( 100 ));
+			}
+		}
+		lane->mSink->flush();
+	}
+};
+
+}
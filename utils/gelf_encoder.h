@@ -0,0 +1,140 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+#include <fmt/format.h>
+
+#include <spdlog/details/log_msg.h>
+
+#include "log_context.h"
+
+namespace utils {
+
+inline int gelfLevel( spdlog::level::level_enum level )
+{
+	int grayLevel = 1;
+
+	switch( level )
+	{
+		case spdlog::level::level_enum::trace :
+			grayLevel = 7;
+		break;
+
+		case spdlog::level::level_enum::debug :
+			grayLevel = 7;
+		break;
+
+		case spdlog::level::level_enum::info :
+			grayLevel = 6;
+		break;
+
+		case spdlog::level::level_enum::warn :
+			grayLevel = 4;
+		break;
+
+		case spdlog::level::level_enum::err :
+			grayLevel = 3;
+		break;
+
+		case spdlog::level::level_enum::critical :
+			grayLevel = 2;
+		break;
+
+		default:
+		break;
+	}
+	return grayLevel;
+}
+
+// Appends text as the content of a JSON string
+inline void appendJSONEscaped( fmt::memory_buffer & out, std::string_view text )
+{
+	static constexpr char	hex[] = "0123456789abcdef";
+	size_t					runStart = 0;
+
+	for( size_t i = 0; i < text.size(); i++ ){
+		const auto c = static_cast<unsigned char>( text[i] );
+
+		if( c >= 0x20 && c != '"' && c != '\\' ){
+			continue;
+		}
+		out.append( text.data() + runStart, text.data() + i );
+		runStart = i + 1;
+		switch( c )
+		{
+			case '"' :
+				out.append( std::string_view( "\\\"" ));
+			break;
+
+			case '\\' :
+				out.append( std::string_view( "\\\\" ));
+			break;
+
+			case '\n' :
+				out.append( std::string_view( "\\n" ));
+			break;
+
+			case '\r' :
+				out.append( std::string_view( "\\r" ));
+			break;
+
+			case '\t' :
+				out.append( std::string_view( "\\t" ));
+			break;
+
+			default:
+				const char escaped[] = { '\\', 'u', '0', '0', hex[ c >> 4 ], hex[ c & 0xf ] };
+
+				out.append( escaped, escaped + sizeof( escaped ));
+			break;
+		}
+	}
+	out.append( text.data() + runStart, text.data() + text.size() );
+}
+
+// Writes GELF 1.1 JSON from a spdlog message without building a JSON DOM.
+// The constant part of the message is escaped once, at construction. Messages logged while handling a
+// traced request get the _trace_id and _span_id additional fields.
+class GelfEncoder
+{
+public:
+	explicit GelfEncoder( const std::string & hostName )
+	{
+		fmt::memory_buffer	prefix;
+
+		prefix.append( std::string_view( "{\"version\":\"1.1\",\"host\":\"" ));
+		appendJSONEscaped( prefix, hostName );
+		prefix.append( std::string_view( "\",\"short_message\":\"" ));
+		mPrefix = fmt::to_string( prefix );
+	}
+
+	// Clears out and writes the message. out is meant to be reused between calls.
+	void encode( const spdlog::details::log_msg & msg, fmt::memory_buffer & out ) const
+	{
+		const auto	millis = std::chrono::duration_cast<std::chrono::milliseconds>( msg.time.time_since_epoch() ).count();
+
+		out.clear();
+		out.append( mPrefix );
+		appendJSONEscaped( out, std::string_view( msg.payload.data(), msg.payload.size() ));
+		fmt::format_to( std::back_inserter( out ), "\",\"timestamp\":{}.{:03},\"level\":{}", millis / 1000, millis % 1000, gelfLevel( msg.level ));
+
+		const auto & context = LogContext::current();
+
+		if( !context.empty() ){
+			// Hex digits, nothing to escape
+			out.append( std::string_view( ",\"_trace_id\":\"" ));
+			out.append( context.traceId() );
+			out.append( std::string_view( "\",\"_span_id\":\"" ));
+			out.append( context.spanId() );
+			out.append( std::string_view( "\"" ));
+		}
+		out.push_back( '}' );
+	}
+
+private:
+	std::string		mPrefix;
+};
+
+}
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#ifdef ZLIB_ENABLED
+#include <zlib.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+namespace utils {
+
+// Non HTTP GELF transports. http:// endpoints are handled by graylog_sink using cpprest.
+class GelfTransport
+{
+public:
+	virtual ~GelfTransport() = default;
+
+	// Sends one serialized GELF message. Safe to call from several threads.
+	virtual bool send( std::string_view message ) = 0;
+};
+
+struct GelfEndpoint
+{
+	std::string		mScheme;
+	std::string		mHost;
+	std::string		mPort;
+};
+
+// schema://host:port
+inline GelfEndpoint parseGelfEndpoint( const std::string & url )
+{
+	GelfEndpoint	res;
+	auto			hostStart = url.find( "://" );
+
+	if( hostStart != std::string::npos ){
+		res.mScheme = url.substr( 0, hostStart );
+		hostStart += 3;
+	}else{
+		hostStart = 0;
+	}
+
+	const auto	hostEnd = url.find_first_of( ":/", hostStart );
+
+	res.mHost = url.substr( hostStart, hostEnd - hostStart );
+	if( hostEnd != std::string::npos && url[ hostEnd ] == ':' ){
+		const auto portEnd = url.find( '/', hostEnd + 1 );
+
+		res.mPort = url.substr( hostEnd + 1, portEnd == std::string::npos ? std::string::npos : portEnd - hostEnd - 1 );
+	}
+	if( res.mPort.empty() ){
+		res.mPort = "12201";
+	}
+	return res;
+}
+
+// GELF UDP: one datagram per message, chunked when the payload does not fit in chunkSize bytes.
+// https://docs.graylog.org/en/3.0/pages/gelf.html#gelf-via-udp
+class GelfUDPTransport : public GelfTransport
+{
+public:
+	static constexpr size_t		ChunkHeaderSize = 12;
+	static constexpr size_t		MaxChunks = 128;
+
+	GelfUDPTransport( const GelfEndpoint & endpoint, size_t chunkSize, bool compress )
+		: mGelfEndpoint( endpoint )
+		, mSocket( mContext )
+		, mChunkSize( std::max( chunkSize, ChunkHeaderSize + 1 ))
+		, mCompress( compress )
+		, mMessageId( std::random_device()() )
+	{
+		mChunk.resize( mChunkSize );
+#ifndef ZLIB_ENABLED
+		if( mCompress ){
+			spdlog::warn( "GELF compression requested but zlib is not available. Sending uncompressed." );
+			mCompress = false;
+		}
+#endif
+	}
+
+	bool send( std::string_view message ) override
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+		const char *				payload = message.data();
+		size_t						payloadSize = message.size();
+
+		if( !mSocket.is_open() && !open() ){
+			return false;
+		}
+
+#ifdef ZLIB_ENABLED
+		if( mCompress ){
+			uLongf compressedSize = compressBound( static_cast<uLong>( message.size() ));
+
+			mCompressed.resize( compressedSize );
+			if( compress2( reinterpret_cast<Bytef *>( mCompressed.data() ), &compressedSize, reinterpret_cast<const Bytef *>( message.data() ), static_cast<uLong>( message.size() ), Z_BEST_SPEED ) == Z_OK ){
+				payload = mCompressed.data();
+				payloadSize = compressedSize;
+			}
+		}
+#endif
+		boost::system::error_code	error;
+
+		if( payloadSize <= mChunkSize ){
+			mSocket.send_to( boost::asio::buffer( payload, payloadSize ), mEndpoint, 0, error );
+		}else{
+			const size_t	dataSize = mChunkSize - ChunkHeaderSize;
+			const size_t	chunks = ( payloadSize + dataSize - 1 ) / dataSize;
+			const uint64_t	messageId = mMessageId++;
+
+			if( chunks > MaxChunks ){
+				spdlog::error( "GELF message of {} bytes needs {} chunks, the limit is {}. Message dropped.", payloadSize, chunks, MaxChunks );
+				return false;
+			}
+			mChunk[0] = 0x1e;
+			mChunk[1] = 0x0f;
+			for( size_t i = 0; i < 8; i++ ){
+				mChunk[ 2 + i ] = static_cast<char>(( messageId >> ( 56 - 8 * i )) & 0xff );
+			}
+			mChunk[11] = static_cast<char>( chunks );
+			for( size_t i = 0; i < chunks && !error; i++ ){
+				const size_t	offset = i * dataSize;
+				const size_t	size = std::min( dataSize, payloadSize - offset );
+
+				mChunk[10] = static_cast<char>( i );
+				std::copy( payload + offset, payload + offset + size, mChunk.begin() + ChunkHeaderSize );
+				mSocket.send_to( boost::asio::buffer( mChunk.data(), ChunkHeaderSize + size ), mEndpoint, 0, error );
+			}
+		}
+		if( error ){
+			spdlog::error( "Error writting to graylog UDP endpoint: {}", error.message() );
+		}
+		return !error;
+	}
+
+private:
+	GelfEndpoint						mGelfEndpoint;
+	boost::asio::io_context				mContext;
+	boost::asio::ip::udp::socket		mSocket;
+	boost::asio::ip::udp::endpoint		mEndpoint;
+	size_t								mChunkSize;
+	bool								mCompress;
+	uint64_t							mMessageId;
+	std::vector<char>					mChunk;
+	std::vector<char>					mCompressed;
+	std::chrono::steady_clock::time_point	mLastFailure;
+	std::mutex							mMutex;
+
+	// Resolves the endpoint and opens the socket. A host that cannot be resolved yet, as while the DNS or the
+	// Graylog container starts, is retried once per second at most, its messages fail meanwhile.
+	bool open()
+	{
+		using namespace std::chrono_literals;
+
+		const auto					now = std::chrono::steady_clock::now();
+		boost::system::error_code	error;
+
+		if( now - mLastFailure < 1s ){
+			return false;
+		}
+
+		boost::asio::ip::udp::resolver	resolver( mContext );
+		const auto						endpoints = resolver.resolve( boost::asio::ip::udp::v4(), mGelfEndpoint.mHost, mGelfEndpoint.mPort, error );
+
+		if( !error ){
+			mEndpoint = *endpoints.begin();
+			mSocket.open( boost::asio::ip::udp::v4(), error );
+		}
+		if( error ){
+			spdlog::error( "Error resolving graylog UDP endpoint {}:{}: {}", mGelfEndpoint.mHost, mGelfEndpoint.mPort, error.message() );
+			mLastFailure = now;
+			return false;
+		}
+		return true;
+	}
+};
+
+// GELF TCP: a single persistent connection, messages are terminated by a null byte.
+// Reconnects once per message if the connection has been lost. Connecting and writing give up after
+// Timeout, so a server that stops reading does not block the sink thread forever.
+class GelfTCPTransport : public GelfTransport
+{
+public:
+	static constexpr std::chrono::seconds	Timeout{ 5 };
+
+	explicit GelfTCPTransport( const GelfEndpoint & endpoint )
+		: mEndpoint( endpoint )
+		, mSocket( mContext )
+	{
+	}
+
+	bool send( std::string_view message ) override
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+		boost::system::error_code	error;
+
+		for( int attempt = 0; attempt < 2; attempt++ ){
+			if( !mSocket.is_open() && !connect() ){
+				return false;
+			}
+			const std::array<boost::asio::const_buffer, 2>	buffers{ boost::asio::buffer( message.data(), message.size() ), boost::asio::buffer( "\0", 1 ) };
+
+			runFor( [ & ]( auto handler ){ boost::asio::async_write( mSocket, buffers, handler ); }, error );
+			if( !error ){
+				return true;
+			}
+			mSocket.close();
+		}
+		spdlog::error( "Error writting to graylog TCP endpoint {}:{}: {}", mEndpoint.mHost, mEndpoint.mPort, error.message() );
+		return false;
+	}
+
+private:
+	GelfEndpoint						mEndpoint;
+	boost::asio::io_context				mContext;
+	boost::asio::ip::tcp::socket		mSocket;
+	std::chrono::steady_clock::time_point	mLastFailure;
+	std::mutex							mMutex;
+
+	bool connect()
+	{
+		using namespace std::chrono_literals;
+
+		const auto					now = std::chrono::steady_clock::now();
+		boost::system::error_code	error;
+
+		// Do not hammer an unreachable server: one connection attempt per second at most
+		if( now - mLastFailure < 1s ){
+			return false;
+		}
+
+		boost::asio::ip::tcp::resolver	resolver( mContext );
+		const auto						endpoints = resolver.resolve( mEndpoint.mHost, mEndpoint.mPort, error );
+
+		if( !error ){
+			runFor( [ & ]( auto handler ){ boost::asio::async_connect( mSocket, endpoints, handler ); }, error );
+		}
+		if( error ){
+			spdlog::error( "Error connecting to graylog TCP endpoint {}:{}: {}", mEndpoint.mHost, mEndpoint.mPort, error.message() );
+			mSocket.close();
+			mLastFailure = now;
+			return false;
+		}
+		mSocket.set_option( boost::asio::ip::tcp::no_delay( true ), error );
+		return true;
+	}
+
+	// Runs the asynchronous operation started by start until it completes or Timeout passes. A blocking
+	// write would not do: asio waits again when SO_SNDTIMEO expires.
+	template<typename Start>
+	void runFor( Start && start, boost::system::error_code & error )
+	{
+		bool	done = false;
+
+		mContext.restart();
+		start( [ & ]( const boost::system::error_code & result, const auto & ){
+			error = result;
+			done = true;
+		});
+		mContext.run_for( Timeout );
+		if( !done ){
+			mSocket.close();
+			mContext.run();
+			error = boost::asio::error::timed_out;
+		}
+	}
+};
+
+// Returns nullptr for http:// and https:// endpoints
+inline std::unique_ptr<GelfTransport> newGelfTransport( const std::string & url, size_t chunkSize, bool compress )
+{
+	std::unique_ptr<GelfTransport>	res;
+	const auto						endpoint = parseGelfEndpoint( url );
+
+	if( endpoint.mScheme == "udp" ){
+		res = std::make_unique<GelfUDPTransport>( endpoint, chunkSize, compress );
+	}else if( endpoint.mScheme == "tcp" ){
+		res = std::make_unique<GelfTCPTransport>( endpoint );
+	}
+	return res;
+}
+
+}
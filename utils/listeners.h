@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "shutdown.h"
+
+#if defined( __linux__ ) && defined( __GLIBC__ )
+#include <dlfcn.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define LISTENERS_ENABLED
+#endif
+
+namespace utils {
+
+// SO_REUSEPORT for the TCP sockets bound while a Scope is alive, see bind below
+class ReusePort
+{
+public:
+	class Scope
+	{
+	public:
+		explicit Scope( bool enabled )
+		{
+			sEnabled = enabled;
+		}
+
+		~Scope()
+		{
+			sEnabled = false;
+		}
+
+		Scope( const Scope & ) = delete;
+		Scope & operator=( const Scope & ) = delete;
+	};
+
+	static bool enabled()
+	{
+		return sEnabled;
+	}
+
+private:
+	static inline std::atomic<bool>	sEnabled{ false };
+};
+
+// Starts count processes that serve the same port, each one with its own threads; the kernel spreads the
+// connections between their listeners (SO_REUSEPORT). This returns in each of them with its index, from 0.
+// The calling process only waits: on SIGINT or SIGTERM it closes a pipe the listeners watch, so they shut
+// down as if they got the signal, and it exits when all of them have. A second signal is passed on.
+// Call it before anything starts a thread: only the calling thread survives a fork. Linux only.
+inline size_t forkListeners( size_t count )
+{
+#ifdef LISTENERS_ENABLED
+	if( count <= 1 ){
+		return 0;
+	}
+	sigset_t			signals;
+	sigset_t			previous;
+	std::vector<pid_t>	children;
+	int					shutdownPipe[2] = { -1, -1 };
+
+	if( pipe( shutdownPipe ) != 0 ){
+		spdlog::error( "Listeners not started: {}", std::strerror( errno ));
+		return 0;
+	}
+	sigemptyset( &signals );
+	sigaddset( &signals, SIGINT );
+	sigaddset( &signals, SIGTERM );
+	sigaddset( &signals, SIGCHLD );
+	// Blocked before forking, so no signal is lost in between
+	sigprocmask( SIG_BLOCK, &signals, &previous );
+	for( size_t i = 0; i < count; i++ ){
+		const pid_t child = fork();
+
+		if( child == 0 ){
+			close( shutdownPipe[1] );
+			// Created with the signals still blocked, they are left to Shutdown
+			std::thread( [ fd = shutdownPipe[0] ](){
+				char	byte = 0;
+
+				// Returns when the parent closes the pipe, or dies
+				while( read( fd, &byte, 1 ) < 0 && errno == EINTR ){
+				}
+				Shutdown::instance().request();
+			}).detach();
+			sigprocmask( SIG_SETMASK, &previous, nullptr );
+			return i;
+		}
+		if( child < 0 ){
+			spdlog::error( "Listener {} not started: {}", i, std::strerror( errno ));
+		}else{
+			children.push_back( child );
+		}
+	}
+	close( shutdownPipe[0] );
+
+	int		exitCode = 0;
+	bool	stopping = false;
+
+	while( !children.empty() ){
+		int	signal = 0;
+
+		if( sigwait( &signals, &signal ) != 0 ){
+			continue;
+		}
+		if( signal != SIGCHLD ){
+			if( stopping ){
+				for( const auto child: children ){
+					kill( child, signal );
+				}
+			}
+			close( shutdownPipe[1] );
+			stopping = true;
+			continue;
+		}
+		int		status = 0;
+		pid_t	child = 0;
+
+		while(( child = waitpid( -1, &status, WNOHANG )) > 0 ){
+			children.erase( std::remove( children.begin(), children.end(), child ), children.end() );
+			if( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ){
+				exitCode = WIFEXITED( status ) ? WEXITSTATUS( status ) : 128 + WTERMSIG( status );
+				spdlog::warn( "Listener process {} ended with {}, {} left", child, exitCode, children.size() );
+			}
+		}
+	}
+	std::exit( exitCode );
+#else
+	if( count > 1 ){
+		spdlog::warn( "Several listeners need Linux, starting one" );
+	}
+	return 0;
+#endif
+}
+
+}
+
+#ifdef LISTENERS_ENABLED
+// cpprest opens and binds the listening socket itself, with no way to set an option before bind. As the
+// executable defines bind, its calls land here first: TCP sockets bound inside a ReusePort::Scope get
+// SO_REUSEPORT, then everything goes to the bind of the C library.
+extern "C" int bind( int fd, const struct sockaddr * address, socklen_t size ) noexcept
+{
+	using Bind = int ( * )( int, const struct sockaddr *, socklen_t );
+
+	static const Bind	libcBind = reinterpret_cast<Bind>( dlsym( RTLD_NEXT, "bind" ));
+	int					type = 0;
+	socklen_t			typeSize = sizeof( type );
+
+	if( utils::ReusePort::enabled() && address && ( address->sa_family == AF_INET || address->sa_family == AF_INET6 ) &&
+		getsockopt( fd, SOL_SOCKET, SO_TYPE, &type, &typeSize ) == 0 && type == SOCK_STREAM ){
+		const int one = 1;
+
+		setsockopt( fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof( one ));
+	}
+	return libcBind( fd, address, size );
+}
+#endif
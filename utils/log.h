@@ -0,0 +1,105 @@
+#pragma once
+
+#include <spdlog/spdlog.h>
+
+#include "binlog.h"
+#include "log_context.h"
+#include "request_log.h"
+
+// Logging macros that evaluate their arguments only when the level is enabled:
+//
+//     LOG_DEBUG( mLogger, "{} {}", expensive(), conversions() );
+//
+// When a BinaryLog is active, statements at its level are also stored there without formatting.
+// Statements below the logger level are logged anyway at the RequestLogLevel of the current request, or
+// kept in its RequestLog, if any.
+// Statements below LOG_ACTIVE_LEVEL are removed at compile time. By default release builds (NDEBUG)
+// keep info and above: build them with DEBUG for the request debug messages of --log-tail and
+// --log-sampled-debug. Set it with -DLOG_ACTIVE_LEVEL=SPDLOG_LEVEL_xxx (CMake option LOG_ACTIVE_LEVEL).
+#ifndef LOG_ACTIVE_LEVEL
+#ifdef NDEBUG
+#define LOG_ACTIVE_LEVEL SPDLOG_LEVEL_INFO
+#else
+#define LOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+#endif
+
+namespace utils {
+
+template<typename... Args>
+void logAt( BinLogSite & site, BinaryLog * binaryLog, bool toText, RequestLog * requestLog, spdlog::logger & logger, spdlog::source_loc location, spdlog::format_string_t<Args...> format, Args &&... args )
+{
+	if( binaryLog ){
+		binaryLog->write( site, args... );
+	}
+	if( toText ){
+		BinaryLog::tSkipText = binaryLog != nullptr;
+		if( logger.should_log( site.mLevel )){
+			logger.log( location, site.mLevel, format, std::forward<Args>( args )... );
+		}else{
+			// Below the logger level, for a sampled request: the logger would drop it, straight to its sinks
+			static thread_local fmt::memory_buffer	text;
+
+			text.clear();
+			fmt::format_to( std::back_inserter( text ), format, std::forward<Args>( args )... );
+
+			const spdlog::details::log_msg	msg( location, logger.name(), site.mLevel, std::string_view( text.data(), text.size() ));
+
+			for( auto & sink: logger.sinks() ){
+				if( sink->should_log( site.mLevel )){
+					sink->log( msg );
+				}
+			}
+		}
+		BinaryLog::tSkipText = false;
+	}else if( requestLog ){
+		requestLog->add( site.mLevel, location, format, std::forward<Args>( args )... );
+	}
+}
+
+}
+
+#define LOG_AT( logger, level, format, ... )																	\
+	do{																											\
+		const bool				toText_ = ( logger )->should_log( level ) || level >= utils::RequestLogLevel::current();	\
+		utils::BinaryLog *		binaryLog_ = utils::BinaryLog::enabled( level );								\
+		utils::RequestLog *		requestLog_ = toText_ ? nullptr : utils::RequestLog::capturing( level );		\
+		if( toText_ || binaryLog_ || requestLog_ ){																\
+			static utils::BinLogSite logSite_( level, __FILE__, __LINE__, format );								\
+			utils::logAt( logSite_, binaryLog_, toText_, requestLog_, *( logger ), spdlog::source_loc{ __FILE__, __LINE__, SPDLOG_FUNCTION }, format, ##__VA_ARGS__ );	\
+		}																										\
+	}while( false )
+
+#define LOG_DISABLED( logger, ... ) ( void )0
+
+#if LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+#define LOG_TRACE( logger, ... ) LOG_AT( logger, spdlog::level::trace, __VA_ARGS__ )
+#else
+#define LOG_TRACE( logger, ... ) LOG_DISABLED( logger, __VA_ARGS__ )
+#endif
+
+#if LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define LOG_DEBUG( logger, ... ) LOG_AT( logger, spdlog::level::debug, __VA_ARGS__ )
+#else
+#define LOG_DEBUG( logger, ... ) LOG_DISABLED( logger, __VA_ARGS__ )
+#endif
+
+#if LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_INFO
+#define LOG_INFO( logger, ... ) LOG_AT( logger, spdlog::level::info, __VA_ARGS__ )
+#else
+#define LOG_INFO( logger, ... ) LOG_DISABLED( logger, __VA_ARGS__ )
+#endif
+
+#if LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_WARN
+#define LOG_WARN( logger, ... ) LOG_AT( logger, spdlog::level::warn, __VA_ARGS__ )
+#else
+#define LOG_WARN( logger, ... ) LOG_DISABLED( logger, __VA_ARGS__ )
+#endif
+
+#if LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_ERROR
+#define LOG_ERROR( logger, ... ) LOG_AT( logger, spdlog::level::err, __VA_ARGS__ )
+#else
+#define LOG_ERROR( logger, ... ) LOG_DISABLED( logger, __VA_ARGS__ )
+#endif
+
+#define LOG_CRITICAL( logger, ... ) LOG_AT( logger, spdlog::level::critical, __VA_ARGS__ )
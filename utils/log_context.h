@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <spdlog/spdlog.h>
+#include <spdlog/pattern_formatter.h>
+
+namespace utils {
+
+// Trace and span ids of the request the current thread is handling, as hex text, so log records can be
+// found from a trace. newSpan formats them once per request; the sinks copy nothing and allocate nothing.
+// fanout_sink carries the context of each message to the sink threads.
+struct LogContext
+{
+	char		mTraceId[32] = {};
+	char		mSpanId[16] = {};
+	uint8_t		mTraceIdSize = 0;		// 0 when the thread is not handling a traced request
+	uint8_t		mSpanIdSize = 0;
+
+	bool empty() const
+	{
+		return mTraceIdSize == 0;
+	}
+
+	std::string_view traceId() const
+	{
+		return std::string_view( mTraceId, mTraceIdSize );
+	}
+
+	std::string_view spanId() const
+	{
+		return std::string_view( mSpanId, mSpanIdSize );
+	}
+
+	// 128 bit trace ids use 32 digits, 64 bit ones 16, as Jaeger shows them
+	void set( uint64_t traceIdHigh, uint64_t traceIdLow, uint64_t spanId )
+	{
+		if( traceIdHigh != 0 ){
+			formatHex( traceIdHigh, mTraceId );
+			formatHex( traceIdLow, mTraceId + 16 );
+			mTraceIdSize = 32;
+		}else{
+			formatHex( traceIdLow, mTraceId );
+			mTraceIdSize = 16;
+		}
+		formatHex( spanId, mSpanId );
+		mSpanIdSize = 16;
+	}
+
+	// Ids of other tracers, as their ToTraceID and ToSpanID write them
+	void set( std::string_view traceId, std::string_view spanId )
+	{
+		mTraceIdSize = static_cast<uint8_t>( std::min( traceId.size(), sizeof( mTraceId )));
+		mSpanIdSize = static_cast<uint8_t>( std::min( spanId.size(), sizeof( mSpanId )));
+		std::memcpy( mTraceId, traceId.data(), mTraceIdSize );
+		std::memcpy( mSpanId, spanId.data(), mSpanIdSize );
+	}
+
+	void clear()
+	{
+		mTraceIdSize = 0;
+		mSpanIdSize = 0;
+	}
+
+	static LogContext & current()
+	{
+		static thread_local LogContext	context;
+
+		return context;
+	}
+
+	class Scope;
+
+private:
+	static void formatHex( uint64_t value, char * out )
+	{
+		static constexpr char	Digits[] = "0123456789abcdef";
+
+		for( int i = 15; i >= 0; i-- ){
+			out[i] = Digits[ value & 0xf ];
+			value >>= 4;
+		}
+	}
+};
+
+// Makes context the one of the current thread while the scope is alive
+class LogContext::Scope
+{
+public:
+	explicit Scope( const LogContext & context = LogContext() ) : mPrevious( current() )
+	{
+		current() = context;
+	}
+
+	~Scope()
+	{
+		current() = mPrevious;
+	}
+
+	Scope( const Scope & ) = delete;
+	Scope & operator=( const Scope & ) = delete;
+
+private:
+	LogContext	mPrevious;
+};
+
+// Lowest level logged while the current thread handles a request, when it is below the logger level.
+// HTTPServer sets, with a Scope, the level of the requests whose trace is sampled, and newSpan applies it
+// once it knows the request is sampled: those requests get their debug messages, the rest only pay for
+// what the logger level lets through. The LOG_xxx macros honour it.
+class RequestLogLevel
+{
+	struct State
+	{
+		spdlog::level::level_enum	mSampled = spdlog::level::off;
+		spdlog::level::level_enum	mCurrent = spdlog::level::off;
+	};
+
+public:
+	static spdlog::level::level_enum current()
+	{
+		return state().mCurrent;
+	}
+
+	// The trace of the request is sampled
+	static void sampled()
+	{
+		state().mCurrent = state().mSampled;
+	}
+
+	class Scope
+	{
+	public:
+		explicit Scope( spdlog::level::level_enum sampled ) : mPrevious( state() )
+		{
+			state().mSampled = sampled;
+			state().mCurrent = spdlog::level::off;
+		}
+
+		~Scope()
+		{
+			state() = mPrevious;
+		}
+
+		Scope( const Scope & ) = delete;
+		Scope & operator=( const Scope & ) = delete;
+
+	private:
+		State	mPrevious;
+	};
+
+private:
+	static State & state()
+	{
+		static thread_local State	current;
+
+		return current;
+	}
+};
+
+// %Q pattern flag: " trace_id={} span_id={}" while the thread handles a traced request, nothing otherwise
+class trace_flag_formatter : public spdlog::custom_flag_formatter
+{
+public:
+	static constexpr char	Flag = 'Q';
+
+	void format( const spdlog::details::log_msg &, const std::tm &, spdlog::memory_buf_t & dest ) override
+	{
+		const auto & context = LogContext::current();
+
+		if( !context.empty() ){
+			dest.append( std::string_view( " trace_id=" ));
+			dest.append( context.traceId() );
+			dest.append( std::string_view( " span_id=" ));
+			dest.append( context.spanId() );
+		}
+	}
+
+	std::unique_ptr<spdlog::custom_flag_formatter> clone() const override
+	{
+		return std::make_unique<trace_flag_formatter>();
+	}
+};
+
+// The spdlog default pattern followed by the trace of the request
+inline std::unique_ptr<spdlog::formatter> newTraceFormatter( const std::string & pattern = "%+%Q" )
+{
+	auto res = std::make_unique<spdlog::pattern_formatter>();
+
+	res->add_flag<trace_flag_formatter>( trace_flag_formatter::Flag ).set_pattern( pattern );
+	return res;
+}
+
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+namespace utils {
+
+struct LogLimitConfig
+{
+	double		mRate = 0;					// messages per second allowed per call site, 0 disables the limit
+	double		mBurst = 20;				// messages allowed in a row before the rate applies
+	int			mSummaryIntervalMs = 10000;	// how often "suppressed N similar messages" is logged
+};
+
+class LogSite;
+
+// Process wide settings of the per call site limiter and the thread that logs the suppression summaries
+class LogLimits
+{
+public:
+	static LogLimits & instance()
+	{
+		static LogLimits limits;
+
+		return limits;
+	}
+
+	~LogLimits()
+	{
+		stop();
+	}
+
+	void start( std::shared_ptr<spdlog::logger> logger, const LogLimitConfig & config );
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex>	lock( mMutex );
+
+			mRunThread = false;
+		}
+		mWakeUp.notify_all();
+		if( mThread.joinable() ){
+			mThread.join();
+		}
+	}
+
+	int64_t intervalNs() const
+	{
+		return mIntervalNs.load( std::memory_order_relaxed );
+	}
+
+	int64_t burstNs() const
+	{
+		return mBurstNs.load( std::memory_order_relaxed );
+	}
+
+	// Called once per site, the first time it suppresses a message
+	void add( LogSite * site );
+
+private:
+	std::atomic<int64_t>			mIntervalNs{ 0 };
+	std::atomic<int64_t>			mBurstNs{ 0 };
+	std::atomic<LogSite *>			mSites{ nullptr };
+	std::shared_ptr<spdlog::logger>	mLogger;
+	std::chrono::milliseconds		mSummaryInterval{ 10000 };
+	std::thread						mThread;
+	bool							mRunThread = false;
+	std::mutex						mMutex;
+	std::condition_variable			mWakeUp;
+
+	void realRun();
+};
+
+// State of a single log statement: file, line and format string. Declared static by LOG_LIMITED.
+// Uses GCRA, the token bucket written as one "theoretical arrival time": allow() is a clock read and a CAS.
+class LogSite
+{
+public:
+	LogSite( const char * file, int line, spdlog::level::level_enum level, const char * format )
+		: mFile( file )
+		, mLine( line )
+		, mLevel( level )
+		, mFormat( format )
+	{
+	}
+
+	bool allow()
+	{
+		const auto &	limits = LogLimits::instance();
+		const int64_t	interval = limits.intervalNs();
+
+		if( interval == 0 ){
+			return true;
+		}
+		const int64_t	now = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+		int64_t			tat = mTAT.load( std::memory_order_relaxed );
+
+		do{
+			if( tat - now > limits.burstNs() ){
+				if( mSuppressed.fetch_add( 1, std::memory_order_relaxed ) == 0 && !mRegistered.exchange( true )){
+					LogLimits::instance().add( this );
+				}
+				return false;
+			}
+		}while( !mTAT.compare_exchange_weak( tat, std::max( tat, now ) + interval, std::memory_order_relaxed ));
+
+		return true;
+	}
+
+private:
+	friend class LogLimits;
+
+	const char *				mFile;
+	int							mLine;
+	spdlog::level::level_enum	mLevel;
+	const char *				mFormat;
+	std::atomic<int64_t>		mTAT{ 0 };
+	std::atomic<uint64_t>		mSuppressed{ 0 };
+	std::atomic<bool>			mRegistered{ false };
+	LogSite *					mNext = nullptr;
+};
+
+inline void LogLimits::start( std::shared_ptr<spdlog::logger> logger, const LogLimitConfig & config )
+{
+	stop();
+	if( config.mRate > 0 ){
+		mIntervalNs = static_cast<int64_t>( 1e9 / config.mRate );
+		mBurstNs = static_cast<int64_t>( 1e9 * config.mBurst / config.mRate );
+		mSummaryInterval = std::chrono::milliseconds( config.mSummaryIntervalMs );
+		mLogger = logger;
+		mRunThread = true;
+		mThread = std::thread( &LogLimits::realRun, this );
+	}else{
+		mIntervalNs = 0;
+	}
+}
+
+inline void LogLimits::add( LogSite * site )
+{
+	LogSite * head = mSites.load();
+
+	do{
+		site->mNext = head;
+	}while( !mSites.compare_exchange_weak( head, site ));
+}
+
+inline void LogLimits::realRun()
+{
+	std::unique_lock<std::mutex>	lock( mMutex );
+
+	while( mRunThread ){
+		mWakeUp.wait_for( lock, mSummaryInterval, [ this ]{ return !mRunThread; });
+		for( LogSite * site = mSites.load(); site; site = site->mNext ){
+			const uint64_t suppressed = site->mSuppressed.exchange( 0, std::memory_order_relaxed );
+
+			if( suppressed > 0 ){
+				mLogger->log( site->mLevel, "Suppressed {} similar messages: \"{}\" at {}:{}", suppressed, site->mFormat, site->mFile, site->mLine );
+			}
+		}
+	}
+}
+
+}
+
+// Logs like logger->log( level, format, ... ) but limited to LogLimitConfig::mRate messages per second for this
+// statement. Suppressed messages are counted and reported periodically.
+#define LOG_LIMITED( logger, level, format, ... )																\
+	do{																											\
+		static utils::LogSite logSite_( __FILE__, __LINE__, level, format );									\
+		if( ( logger )->should_log( level ) && logSite_.allow() ){												\
+			( logger )->log( level, format, ##__VA_ARGS__ );													\
+		}																										\
+	}while( false )
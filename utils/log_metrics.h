@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace utils {
+
+struct GraylogStats
+{
+	size_t		mQueueDepth = 0;
+	uint64_t	mDropped = 0;
+	uint64_t	mSent = 0;
+	uint64_t	mFailed = 0;
+	size_t		mSpillPendingBytes = 0;
+	uint64_t	mSpillDropped = 0;
+};
+
+// A sink written by fanout_sink
+struct SinkStats
+{
+	std::string		mName;
+	uint64_t		mLogged = 0;
+	uint64_t		mDropped = 0;		// the sink queue was full
+	size_t			mQueueDepth = 0;
+	double			mAvgQueueMs = 0;	// from the log call to the sink
+	double			mMaxQueueMs = 0;
+	double			mAvgLogUs = 0;		// time spent in the sink
+	double			mMaxLogUs = 0;
+};
+
+struct FanoutStats
+{
+	uint64_t				mDropped = 0;	// the queue of the logging threads was full
+	std::vector<SinkStats>	mSinks;
+};
+
+// Counters of the log sinks, served in /metrics with the spans ones. newLogger registers the sinks it creates,
+// each source returns empty stats once its sink is gone.
+class LogMetrics
+{
+public:
+	static LogMetrics & instance()
+	{
+		static LogMetrics metrics;
+
+		return metrics;
+	}
+
+	void setGraylog( std::function<GraylogStats()> source )
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		mGraylog = std::move( source );
+	}
+
+	void setFanout( std::function<FanoutStats()> source )
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		mFanout = std::move( source );
+	}
+
+	// Prometheus text format, nothing when no sink is registered
+	std::string prometheus() const
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+		std::string					res;
+
+		if( mGraylog ){
+			const GraylogStats	stats = mGraylog();
+
+			fmt::format_to( std::back_inserter( res ),
+				"# HELP graylog_messages_sent_total Messages sent to Graylog.\n# TYPE graylog_messages_sent_total counter\ngraylog_messages_sent_total {}\n"
+				"# HELP graylog_messages_failed_total Messages that could not be sent to Graylog, including retries.\n# TYPE graylog_messages_failed_total counter\ngraylog_messages_failed_total {}\n"
+				"# HELP graylog_messages_dropped_total Messages discarded by the overflow policy of the queue.\n# TYPE graylog_messages_dropped_total counter\ngraylog_messages_dropped_total {}\n"
+				"# HELP graylog_queue_length Messages waiting to be sent.\n# TYPE graylog_queue_length gauge\ngraylog_queue_length {}\n"
+				"# HELP graylog_spill_bytes Bytes in the spill file waiting to be replayed.\n# TYPE graylog_spill_bytes gauge\ngraylog_spill_bytes {}\n"
+				"# HELP graylog_spill_dropped_total Messages lost because the spill file was full.\n# TYPE graylog_spill_dropped_total counter\ngraylog_spill_dropped_total {}\n",
+				stats.mSent, stats.mFailed, stats.mDropped, stats.mQueueDepth, stats.mSpillPendingBytes, stats.mSpillDropped );
+		}
+		if( mFanout ){
+			const FanoutStats	stats = mFanout();
+			std::string			logged;
+			std::string			dropped;
+			std::string			depth;
+			std::string			delay;
+
+			for( const auto & sink: stats.mSinks ){
+				fmt::format_to( std::back_inserter( logged ), "log_messages_total{{sink=\"{}\"}} {}\n", sink.mName, sink.mLogged );
+				fmt::format_to( std::back_inserter( dropped ), "log_messages_dropped_total{{sink=\"{}\"}} {}\n", sink.mName, sink.mDropped );
+				fmt::format_to( std::back_inserter( depth ), "log_sink_queue_length{{sink=\"{}\"}} {}\n", sink.mName, sink.mQueueDepth );
+				fmt::format_to( std::back_inserter( delay ), "log_sink_delay_seconds_max{{sink=\"{}\"}} {}\n", sink.mName, sink.mMaxQueueMs / 1e3 );
+			}
+			fmt::format_to( std::back_inserter( dropped ), "log_messages_dropped_total{{sink=\"all\"}} {}\n", stats.mDropped );
+			res += "# HELP log_messages_total Messages written by each log sink.\n# TYPE log_messages_total counter\n" + logged
+				+ "# HELP log_messages_dropped_total Messages lost because the queue of the sink, or of all of them, was full.\n# TYPE log_messages_dropped_total counter\n" + dropped
+				+ "# HELP log_sink_queue_length Messages waiting for each log sink.\n# TYPE log_sink_queue_length gauge\n" + depth
+				+ "# HELP log_sink_delay_seconds_max Longest time from the log call to the sink.\n# TYPE log_sink_delay_seconds_max gauge\n" + delay;
+		}
+		return res;
+	}
+
+private:
+	mutable std::mutex				mMutex;
+	std::function<GraylogStats()>	mGraylog;
+	std::function<FanoutStats()>	mFanout;
+};
+
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <spdlog/common.h>
+
+namespace utils {
+
+// What to do when a log queue is full
+enum class OverflowPolicy {
+	Block,			// the caller waits for free space
+	DropOldest,		// the oldest queued message is discarded
+	DropByLevel		// messages at or below the drop level are discarded, more severe ones evict the oldest low level one,
+					// or the oldest one if all are severe
+};
+
+// Lets cxxopts parse the policy: block, drop-oldest or drop-by-level
+inline std::istream & operator>>( std::istream & in, OverflowPolicy & policy )
+{
+	std::string text;
+
+	in >> text;
+	if( text == "block" ){
+		policy = OverflowPolicy::Block;
+	}else if( text == "drop-oldest" ){
+		policy = OverflowPolicy::DropOldest;
+	}else if( text == "drop-by-level" ){
+		policy = OverflowPolicy::DropByLevel;
+	}else{
+		in.setstate( std::ios::failbit );
+	}
+	return in;
+}
+
+template<typename T>
+class LogQueue
+{
+public:
+	LogQueue( size_t capacity, OverflowPolicy policy, spdlog::level::level_enum dropLevel )
+		: mCapacity( capacity > 0 ? capacity : 1 )
+		, mPolicy( policy )
+		, mDropLevel( dropLevel )
+	{
+	}
+
+	// Called under the queue lock with each message, oldest first
+	using Handler = std::function<void( T & item, spdlog::level::level_enum level )>;
+
+	// When set, a full queue hands the queued messages and the new one to overflow instead of applying the
+	// policy, e.g. to keep them in a file. Set it before pushing.
+	void setOverflow( Handler overflow )
+	{
+		mOverflow = std::move( overflow );
+	}
+
+	// Returns false if the message (or an older one) has been discarded to make room
+	bool push( T && item, spdlog::level::level_enum level )
+	{
+		bool							res = true;
+		std::unique_lock<std::mutex>	lock( mMutex );
+
+		if( mClosed ){
+			mDropped++;
+			return false;
+		}
+		if( mItems.size() >= mCapacity && mOverflow ){
+			takeAll( mOverflow );
+			mOverflow( item, level );
+			return true;
+		}
+		if( mItems.size() >= mCapacity ){
+			switch( mPolicy )
+			{
+				case OverflowPolicy::Block :
+					mNotFull.wait( lock, [ this ]{ return mItems.size() < mCapacity || mClosed; });
+					if( mClosed ){
+						mDropped++;
+						return false;
+					}
+				break;
+
+				case OverflowPolicy::DropOldest :
+					mItems.pop_front();
+					mDropped++;
+					res = false;
+				break;
+
+				case OverflowPolicy::DropByLevel :
+					if( level <= mDropLevel ){
+						mDropped++;
+						return false;
+					}else{
+						auto iter = mItems.begin();
+
+						while( iter != mItems.end() && iter->mLevel > mDropLevel ){
+							++iter;
+						}
+						// Never waits, the logging threads must not stall
+						mItems.erase( iter != mItems.end() ? iter : mItems.begin() );
+						mDropped++;
+						res = false;
+					}
+				break;
+			}
+		}
+		mItems.push_back({ std::move( item ), level });
+		mDepth = mItems.size();
+		if( mItems.size() >= mBatchHint ){
+			mNotEmpty.notify_one();
+		}
+		return res;
+	}
+
+	// Waits until there are maxItems queued, the timeout expires, a flush is requested or the queue is closed.
+	// Returns false when the queue is closed and empty.
+	bool popBatch( std::vector<T> & batch, size_t maxItems, std::chrono::milliseconds timeout )
+	{
+		std::unique_lock<std::mutex>	lock( mMutex );
+
+		mBatchHint = maxItems;
+		mNotEmpty.wait_for( lock, timeout, [ this, maxItems ]{ return mItems.size() >= maxItems || mFlushRequested || mClosed; });
+		mFlushRequested = false;
+		while( !mItems.empty() && batch.size() < maxItems ){
+			batch.push_back( std::move( mItems.front().mItem ));
+			mItems.pop_front();
+		}
+		mInFlight += batch.size();
+		mDepth = mItems.size();
+		mNotFull.notify_all();
+
+		return !( mClosed && mItems.empty() && batch.empty() );
+	}
+
+	// Waits as popBatch does, then hands every queued message to handler under the queue lock, so they are
+	// handled in order with the ones given to the overflow handler. Returns false when the queue is closed
+	// and empty.
+	bool takeAll( const Handler & handler, size_t minItems, std::chrono::milliseconds timeout )
+	{
+		std::unique_lock<std::mutex>	lock( mMutex );
+
+		mBatchHint = minItems;
+		mNotEmpty.wait_for( lock, timeout, [ this, minItems ]{ return mItems.size() >= minItems || mFlushRequested || mClosed; });
+		mFlushRequested = false;
+
+		const bool res = !( mClosed && mItems.empty() );
+
+		takeAll( handler );
+		return res;
+	}
+
+	// Called by the consumer when a batch returned by popBatch has been processed
+	void done( size_t items )
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		mInFlight -= items;
+		if( mItems.empty() && mInFlight == 0 ){
+			mDrained.notify_all();
+		}
+	}
+
+	// Asks the consumer to send what is queued and waits until it is done
+	bool flush( std::chrono::milliseconds timeout )
+	{
+		std::unique_lock<std::mutex>	lock( mMutex );
+
+		mFlushRequested = true;
+		mNotEmpty.notify_one();
+		return mDrained.wait_for( lock, timeout, [ this ]{ return mItems.empty() && mInFlight == 0; });
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		mClosed = true;
+		mNotEmpty.notify_all();
+		mNotFull.notify_all();
+	}
+
+	bool full() const
+	{
+		return mDepth >= mCapacity;
+	}
+
+	size_t depth() const
+	{
+		return mDepth;
+	}
+
+	uint64_t dropped() const
+	{
+		return mDropped;
+	}
+
+private:
+	// Must hold mMutex
+	void takeAll( const Handler & handler )
+	{
+		for( auto & entry: mItems ){
+			handler( entry.mItem, entry.mLevel );
+		}
+		mItems.clear();
+		mDepth = 0;
+		mNotFull.notify_all();
+		if( mInFlight == 0 ){
+			mDrained.notify_all();
+		}
+	}
+
+	struct Entry
+	{
+		T							mItem;
+		spdlog::level::level_enum	mLevel;
+	};
+
+	const size_t				mCapacity;
+	const OverflowPolicy		mPolicy;
+	spdlog::level::level_enum	mDropLevel;
+	size_t						mBatchHint = 1;
+	size_t						mInFlight = 0;
+	bool						mClosed = false;
+	bool						mFlushRequested = false;
+	Handler						mOverflow;
+	std::deque<Entry>			mItems;
+	std::mutex					mMutex;
+	std::condition_variable		mNotEmpty;
+	std::condition_variable		mNotFull;
+	std::condition_variable		mDrained;
+	std::atomic<size_t>			mDepth{ 0 };
+	std::atomic<uint64_t>		mDropped{ 0 };
+};
+
+}
@@ -0,0 +1,848 @@
+#pragma once
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <opentracing/tracer.h>
+#include <opentracing/span.h>
+#include <opentracing/ext/tags.h>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "bounded_queue.h"
+#include "span_exporter.h"
+#include "span_metrics.h"
+#include "tail_sampler.h"
+#include "trace_context.h"
+
+namespace utils {
+
+class NativeTracer;
+
+// Recycles the memory of T on the thread that deletes it, so the spans and contexts of each request
+// do not go to the allocator. Each thread keeps up to MaxFree blocks and frees them when it exits.
+template<typename T>
+class Pooled
+{
+public:
+	static void * operator new( size_t size )
+	{
+		auto & pool = freeList();
+
+		if( size != sizeof( T ) || pool.mBlocks.empty() ){
+			return ::operator new( size );
+		}
+		void * res = pool.mBlocks.back();
+
+		pool.mBlocks.pop_back();
+		return res;
+	}
+
+	static void operator delete( void * block, size_t size )
+	{
+		auto & pool = freeList();
+
+		if( size != sizeof( T ) || pool.mBlocks.size() >= MaxFree ){
+			::operator delete( block );
+		}else{
+			pool.mBlocks.push_back( block );
+		}
+	}
+
+private:
+	static constexpr size_t	MaxFree = 256;
+
+	struct FreeList
+	{
+		std::vector<void *>	mBlocks;
+
+		FreeList()
+		{
+			mBlocks.reserve( MaxFree );
+		}
+
+		~FreeList()
+		{
+			for( auto block: mBlocks ){
+				::operator delete( block );
+			}
+		}
+	};
+
+	static FreeList & freeList()
+	{
+		static thread_local FreeList	pool;
+
+		return pool;
+	}
+};
+
+class NativeSpanContext : public opentracing::SpanContext, public Pooled<NativeSpanContext>
+{
+public:
+	uint64_t										mTraceIdHigh = 0;
+	uint64_t										mTraceIdLow = 0;
+	uint64_t										mSpanId = 0;
+	uint64_t										mParentId = 0;
+	bool											mSampled = true;
+	std::vector<std::pair<std::string, std::string>>	mBaggage;
+	std::string										mTraceState;		// W3C tracestate, passed on as received
+	bool											mRemote = false;	// extracted from a request
+
+	void ForeachBaggageItem( std::function<bool( const std::string & key, const std::string & value )> f ) const override
+	{
+		for( const auto & [ key, value ]: mBaggage ){
+			if( !f( key, value )){
+				break;
+			}
+		}
+	}
+
+	std::string ToTraceID() const noexcept override
+	{
+		return mTraceIdHigh != 0 ? fmt::format( "{:x}{:016x}", mTraceIdHigh, mTraceIdLow ) : fmt::format( "{:x}", mTraceIdLow );
+	}
+
+	std::string ToSpanID() const noexcept override
+	{
+		return fmt::format( "{:x}", mSpanId );
+	}
+
+	std::unique_ptr<opentracing::SpanContext> Clone() const noexcept override
+	{
+		return std::make_unique<NativeSpanContext>( *this );
+	}
+
+	// Jaeger propagation format: {trace-id}:{span-id}:{parent-span-id}:{flags}
+	std::string toUberTraceId() const
+	{
+		return fmt::format( "{}:{:x}:{:x}:{:x}", ToTraceID(), mSpanId, mParentId, mSampled ? 1 : 0 );
+	}
+
+	TraceParent toTraceParent() const
+	{
+		TraceParent	res;
+
+		res.mTraceIdHigh = mTraceIdHigh;
+		res.mTraceIdLow = mTraceIdLow;
+		res.mParentId = mSpanId;
+		res.mFlags = mSampled ? 1 : 0;
+		return res;
+	}
+
+	void fromTraceParent( const TraceParent & traceParent )
+	{
+		mTraceIdHigh = traceParent.mTraceIdHigh;
+		mTraceIdLow = traceParent.mTraceIdLow;
+		mSpanId = traceParent.mParentId;
+		mParentId = 0;
+		mSampled = traceParent.sampled();
+	}
+
+	bool parseUberTraceId( opentracing::string_view text )
+	{
+		uint64_t	fields[4] = { 0, 0, 0, 0 };
+		size_t		field = 0;
+		size_t		digits = 0;
+
+		mTraceIdHigh = 0;
+		for( const char c: text ){
+			uint64_t digit;
+
+			if( c == ':' ){
+				if( digits == 0 || ++field == 4 ){
+					return false;
+				}
+				digits = 0;
+				continue;
+			}else if( c >= '0' && c <= '9' ){
+				digit = c - '0';
+			}else if( c >= 'a' && c <= 'f' ){
+				digit = c - 'a' + 10;
+			}else if( c >= 'A' && c <= 'F' ){
+				digit = c - 'A' + 10;
+			}else{
+				return false;
+			}
+			if( ++digits > 16 ){
+				// 128 bit trace ids: the first 64 bits overflow into mTraceIdHigh
+				if( field != 0 || digits > 32 ){
+					return false;
+				}
+				mTraceIdHigh = ( mTraceIdHigh << 4 ) | ( fields[0] >> 60 );
+			}
+			fields[ field ] = ( fields[ field ] << 4 ) | digit;
+		}
+		if( field != 3 || digits == 0 || ( fields[0] == 0 && mTraceIdHigh == 0 ) ){
+			return false;
+		}
+		mTraceIdLow = fields[0];
+		mSpanId = fields[1];
+		mParentId = fields[2];
+		mSampled = ( fields[3] & 1 ) != 0;
+		return true;
+	}
+};
+
+class NativeSpan : public opentracing::Span, public Pooled<NativeSpan>
+{
+public:
+	NativeSpan( std::shared_ptr<const NativeTracer> tracer, NativeSpanContext && context, SpanData * data, opentracing::SteadyTime start, uint32_t operation )
+		: mTracer( std::move( tracer ))
+		, mContext( std::move( context ))
+		, mData( data )
+		, mStart( start )
+		, mOperation( operation )
+	{
+	}
+
+	~NativeSpan() override
+	{
+		if( !mFinished ){
+			Finish();
+		}
+	}
+
+	void FinishWithOptions( const opentracing::FinishSpanOptions & options ) noexcept override;
+
+	void SetOperationName( opentracing::string_view name ) noexcept override
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		if( mData ){
+			mData->mOperation.assign( name.data(), name.size() );
+		}
+	}
+
+	void SetTag( opentracing::string_view key, const opentracing::Value & value ) noexcept override
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		if( key == opentracing::ext::sampling_priority ){
+			mContext.mSampled = isPositive( value );
+		}else if( std::string_view( key.data(), key.size() ) == tags::Interned[ tags::ErrorId ] ){
+			// Kept for the observer of the tracer also when the span is not recorded
+			mError = value.is<bool>() && value.get<bool>();
+		}
+		if( mData && mContext.mSampled && mData->mTagCount < SpanData::MaxTags && toTag( key, value, mData->mTags[ mData->mTagCount ] )){
+			mData->mTagCount++;
+		}
+	}
+
+	void SetBaggageItem( opentracing::string_view restrictedKey, opentracing::string_view value ) noexcept override
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		for( auto & item: mContext.mBaggage ){
+			if( item.first == restrictedKey ){
+				item.second.assign( value.data(), value.size() );
+				return;
+			}
+		}
+		mContext.mBaggage.emplace_back( std::string( restrictedKey.data(), restrictedKey.size() ), std::string( value.data(), value.size() ));
+	}
+
+	std::string BaggageItem( opentracing::string_view restrictedKey ) const noexcept override
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		for( const auto & item: mContext.mBaggage ){
+			if( item.first == restrictedKey ){
+				return item.second;
+			}
+		}
+		return {};
+	}
+
+	void Log( std::initializer_list<std::pair<opentracing::string_view, opentracing::Value>> fields ) noexcept override
+	{
+		Log( opentracing::SystemClock::now(), fields );
+	}
+
+	void Log( opentracing::SystemTime timestamp, std::initializer_list<std::pair<opentracing::string_view, opentracing::Value>> fields ) noexcept override
+	{
+		addLog( timestamp, fields.begin(), fields.end() );
+	}
+
+	void Log( opentracing::SystemTime timestamp, const std::vector<std::pair<opentracing::string_view, opentracing::Value>> & fields ) noexcept override
+	{
+		addLog( timestamp, fields.begin(), fields.end() );
+	}
+
+	const opentracing::SpanContext & context() const noexcept override
+	{
+		return mContext;
+	}
+
+	const opentracing::Tracer & tracer() const noexcept override;
+
+	// Converts the scalar opentracing values, the rest are skipped
+	static bool toTag( opentracing::string_view key, const opentracing::Value & value, SpanTag & tag )
+	{
+		tag.setKey( std::string_view( key.data(), key.size() ));
+		if( value.is<std::string>() ){
+			tag.setString( value.get<std::string>() );
+		}else if( value.is<opentracing::string_view>() ){
+			tag.setString( std::string_view( value.get<opentracing::string_view>().data(), value.get<opentracing::string_view>().size() ));
+		}else if( value.is<const char *>() ){
+			tag.setString( value.get<const char *>() );
+		}else if( value.is<bool>() ){
+			tag.mType = SpanTag::Type::Bool;
+			tag.mBool = value.get<bool>();
+		}else if( value.is<double>() ){
+			tag.mType = SpanTag::Type::Double;
+			tag.mDouble = value.get<double>();
+		}else if( value.is<int64_t>() ){
+			tag.mType = SpanTag::Type::Long;
+			tag.mLong = value.get<int64_t>();
+		}else if( value.is<uint64_t>() ){
+			tag.mType = SpanTag::Type::Long;
+			tag.mLong = static_cast<int64_t>( value.get<uint64_t>() );
+		}else{
+			return false;
+		}
+		return true;
+	}
+
+	// sampling.priority: 0 or less drops the trace
+	static bool isPositive( const opentracing::Value & value )
+	{
+		if( value.is<int64_t>() ){
+			return value.get<int64_t>() > 0;
+		}else if( value.is<uint64_t>() ){
+			return value.get<uint64_t>() > 0;
+		}else if( value.is<bool>() ){
+			return value.get<bool>();
+		}else if( value.is<double>() ){
+			return value.get<double>() > 0;
+		}
+		return true;
+	}
+
+private:
+	static constexpr size_t	MaxLogs = 32;
+
+	std::shared_ptr<const NativeTracer>	mTracer;
+	NativeSpanContext					mContext;
+	SpanData *							mData;			// nullptr when the span is not recorded
+	const opentracing::SteadyTime		mStart;
+	const uint32_t						mOperation;		// from the SpanObserver of the tracer
+	bool								mFinished = false;
+	bool								mError = false;
+	mutable std::mutex					mMutex;
+
+	template<typename Iter>
+	void addLog( opentracing::SystemTime timestamp, Iter begin, Iter end )
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		if( !mData || !mContext.mSampled || mData->mLogCount == MaxLogs ){
+			return;
+		}
+		if( mData->mLogs.size() == mData->mLogCount ){
+			mData->mLogs.emplace_back();
+		}
+		SpanLog &	log = mData->mLogs[ mData->mLogCount++ ];
+		size_t		count = 0;
+
+		log.mTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>( timestamp.time_since_epoch() ).count();
+		for( auto iter = begin; iter != end; ++iter ){
+			if( log.mFields.size() == count ){
+				log.mFields.emplace_back();
+			}
+			if( toTag( iter->first, iter->second, log.mFields[ count ] )){
+				count++;
+			}
+		}
+		log.mFields.resize( count );
+	}
+};
+
+struct NativeTracerStats
+{
+	uint64_t	mStarted = 0;
+	uint64_t	mExported = 0;
+	uint64_t	mDropped = 0;		// sampled spans not recorded because every slot was in use
+};
+
+// OpenTracing tracer that needs no client library. Spans are recorded into a fixed set of slots, allocated
+// once; finished spans are queued in a lock-free ring and a background thread hands them in batches to the
+// exporter, then returns the slots. When every slot is in use new spans are not recorded.
+// Extracts both the W3C traceparent and the Jaeger uber-trace-id; injects the configured one.
+class NativeTracer : public opentracing::Tracer, public std::enable_shared_from_this<NativeTracer>
+{
+public:
+	static constexpr size_t	MaxBatch = 256;
+
+	NativeTracer( std::unique_ptr<SpanExporter> exporter, size_t slots, bool logSpans = false, PropagationFormat propagation = PropagationFormat::W3C,
+					SpanObserver * observer = nullptr )
+		: mExporter( std::move( exporter ))
+		, mObserver( observer )
+		, mLogSpans( logSpans )
+		, mPropagation( propagation )
+		, mSlots( std::max<size_t>( slots, 1 ))
+		, mFree( mSlots.size() )
+		, mCompleted( mSlots.size() )
+	{
+		for( uint32_t i = 0; i < mSlots.size(); i++ ){
+			mFree.tryPush( uint32_t( i ));
+		}
+		mExporterThread = std::thread( &NativeTracer::realRun, this );
+	}
+
+	~NativeTracer() override
+	{
+		Close();
+	}
+
+	std::unique_ptr<opentracing::Span> StartSpanWithOptions( opentracing::string_view operationName, const opentracing::StartSpanOptions & options ) const noexcept override
+	{
+		try{
+			NativeSpanContext	context;
+			bool				localRoot = true;
+
+			for( const auto & [ type, referenced ]: options.references ){
+				const auto parent = dynamic_cast<const NativeSpanContext *>( referenced );
+
+				if( parent ){
+					localRoot = parent->mRemote;
+					context.mTraceIdHigh = parent->mTraceIdHigh;
+					context.mTraceIdLow = parent->mTraceIdLow;
+					context.mParentId = parent->mSpanId;
+					context.mSampled = parent->mSampled;
+					context.mBaggage = parent->mBaggage;
+					context.mTraceState = parent->mTraceState;
+					break;
+				}
+			}
+			context.mSpanId = randomId();
+			if( context.mTraceIdLow == 0 && context.mTraceIdHigh == 0 ){
+				// 128 bit trace ids, as W3C Trace Context expects
+				context.mTraceIdHigh = randomId();
+				context.mTraceIdLow = context.mSpanId;
+			}
+			for( const auto & [ key, value ]: options.tags ){
+				if( key == opentracing::ext::sampling_priority ){
+					context.mSampled = NativeSpan::isPositive( value );
+				}
+			}
+			mStarted.fetch_add( 1, std::memory_order_relaxed );
+
+			const auto	start = options.start_steady_timestamp == opentracing::SteadyTime() ? opentracing::SteadyClock::now() : options.start_steady_timestamp;
+			SpanData *	data = context.mSampled ? acquire() : nullptr;
+
+			if( data ){
+				const auto startSystem = options.start_system_timestamp == opentracing::SystemTime() ? opentracing::SystemClock::now() : options.start_system_timestamp;
+
+				data->mTraceIdHigh = context.mTraceIdHigh;
+				data->mTraceIdLow = context.mTraceIdLow;
+				data->mSpanId = context.mSpanId;
+				data->mParentId = context.mParentId;
+				data->mOperation.assign( operationName.data(), operationName.size() );
+				data->mStartNs = std::chrono::duration_cast<std::chrono::nanoseconds>( startSystem.time_since_epoch() ).count();
+				data->mDurationNs = 0;
+				data->mLocalRoot = localRoot;
+				data->mTagCount = 0;
+				data->mLogCount = 0;
+				for( const auto & [ key, value ]: options.tags ){
+					if( data->mTagCount < SpanData::MaxTags && NativeSpan::toTag( key, value, data->mTags[ data->mTagCount ] )){
+						data->mTagCount++;
+					}
+				}
+			}
+			return std::make_unique<NativeSpan>( shared_from_this(), std::move( context ), data, start,
+				mObserver ? mObserver->started( std::string_view( operationName.data(), operationName.size() )) : 0 );
+		}catch( ... ){
+			return nullptr;
+		}
+	}
+
+	opentracing::expected<void> Inject( const opentracing::SpanContext & sc, std::ostream & writer ) const override
+	{
+		const auto context = dynamic_cast<const NativeSpanContext *>( &sc );
+
+		if( !context ){
+			return opentracing::make_unexpected( opentracing::invalid_span_context_error );
+		}
+		writer << context->toUberTraceId() << '\n';
+		return {};
+	}
+
+	opentracing::expected<void> Inject( const opentracing::SpanContext & sc, const opentracing::TextMapWriter & writer ) const override
+	{
+		return injectTextMap( sc, writer );
+	}
+
+	opentracing::expected<void> Inject( const opentracing::SpanContext & sc, const opentracing::HTTPHeadersWriter & writer ) const override
+	{
+		return injectTextMap( sc, writer );
+	}
+
+	opentracing::expected<std::unique_ptr<opentracing::SpanContext>> Extract( std::istream & reader ) const override
+	{
+		std::string	text;
+		auto		context = std::make_unique<NativeSpanContext>();
+
+		if( !std::getline( reader, text ) || text.empty() ){
+			return std::unique_ptr<opentracing::SpanContext>();
+		}
+		if( !context->parseUberTraceId( text )){
+			return opentracing::make_unexpected( opentracing::span_context_corrupted_error );
+		}
+		context->mRemote = true;
+		return std::unique_ptr<opentracing::SpanContext>( std::move( context ));
+	}
+
+	opentracing::expected<std::unique_ptr<opentracing::SpanContext>> Extract( const opentracing::TextMapReader & reader ) const override
+	{
+		return extractTextMap( reader );
+	}
+
+	opentracing::expected<std::unique_ptr<opentracing::SpanContext>> Extract( const opentracing::HTTPHeadersReader & reader ) const override
+	{
+		return extractTextMap( reader );
+	}
+
+	// Stops the exporter thread once every finished span has been exported
+	void Close() noexcept override
+	{
+		if( mRunThread.exchange( false )){
+			mCompleted.wakeUp();
+			mExporterThread.join();
+			exportCompleted();
+		}
+	}
+
+	SpanObserver * observer() const
+	{
+		return mObserver;
+	}
+
+	NativeTracerStats stats() const
+	{
+		NativeTracerStats	res;
+
+		res.mStarted = mStarted.load( std::memory_order_relaxed );
+		res.mExported = mExported.load( std::memory_order_relaxed );
+		res.mDropped = mDropped.load( std::memory_order_relaxed );
+		return res;
+	}
+
+	// Called by NativeSpan::FinishWithOptions
+	void finished( SpanData * data, bool sampled ) const
+	{
+		const uint32_t index = static_cast<uint32_t>( data - mSlots.data() );
+
+		if( sampled ){
+			mCompleted.tryPush( uint32_t( index ));
+		}else{
+			mFree.tryPush( uint32_t( index ));
+		}
+	}
+
+private:
+	static constexpr std::string_view	TraceIdHeader = "uber-trace-id";
+	static constexpr std::string_view	BaggagePrefix = "uberctx-";
+	static constexpr std::string_view	BaggageHeader = "baggage";		// W3C
+
+	std::unique_ptr<SpanExporter>				mExporter;
+	SpanObserver * const						mObserver;			// not owned, sees every span, sampled or not
+	const bool									mLogSpans;
+	const PropagationFormat						mPropagation;
+	std::vector<SpanData>						mSlots;
+	mutable BoundedQueue<uint32_t>				mFree;
+	mutable BoundedQueue<uint32_t>				mCompleted;
+	std::vector<const SpanData *>				mBatch;
+	std::vector<uint32_t>						mBatchSlots;
+	std::thread									mExporterThread;
+	std::atomic<bool>							mRunThread{ true };
+	mutable std::atomic<uint64_t>				mStarted{ 0 };
+	mutable std::atomic<uint64_t>				mExported{ 0 };
+	mutable std::atomic<uint64_t>				mDropped{ 0 };
+
+	static uint64_t randomId()
+	{
+		static thread_local std::mt19937_64	random( std::random_device{}() );
+		uint64_t							res;
+
+		do{
+			res = random();
+		}while( res == 0 );
+		return res;
+	}
+
+	SpanData * acquire() const
+	{
+		uint32_t	index;
+
+		if( !mFree.tryPop( index )){
+			mDropped.fetch_add( 1, std::memory_order_relaxed );
+			return nullptr;
+		}
+		return const_cast<SpanData *>( &mSlots[ index ] );
+	}
+
+	static bool equalsNoCase( opentracing::string_view a, std::string_view b )
+	{
+		if( a.size() != b.size() ){
+			return false;
+		}
+		for( size_t i = 0; i < b.size(); i++ ){
+			if( std::tolower( static_cast<unsigned char>( a.data()[i] )) != b[i] ){
+				return false;
+			}
+		}
+		return true;
+	}
+
+	opentracing::expected<void> injectTextMap( const opentracing::SpanContext & sc, const opentracing::TextMapWriter & writer ) const
+	{
+		const auto context = dynamic_cast<const NativeSpanContext *>( &sc );
+
+		if( !context ){
+			return opentracing::make_unexpected( opentracing::invalid_span_context_error );
+		}
+		if( mPropagation == PropagationFormat::W3C ){
+			return injectW3C( *context, writer );
+		}
+		auto res = writer.Set( opentracing::string_view( TraceIdHeader.data(), TraceIdHeader.size() ), context->toUberTraceId() );
+
+		for( const auto & [ key, value ]: context->mBaggage ){
+			if( res ){
+				res = writer.Set( std::string( BaggagePrefix ) + key, value );
+			}
+		}
+		return res;
+	}
+
+	static opentracing::expected<void> injectW3C( const NativeSpanContext & context, const opentracing::TextMapWriter & writer )
+	{
+		char	traceParent[ TraceParent::Size ];
+
+		context.toTraceParent().format( traceParent );
+
+		auto res = writer.Set( opentracing::string_view( TraceParent::Header.data(), TraceParent::Header.size() ), opentracing::string_view( traceParent, sizeof( traceParent )));
+
+		if( res && !context.mTraceState.empty() ){
+			res = writer.Set( opentracing::string_view( TraceParent::StateHeader.data(), TraceParent::StateHeader.size() ), context.mTraceState );
+		}
+		if( res && !context.mBaggage.empty() ){
+			std::string	baggage;
+
+			for( const auto & [ key, value ]: context.mBaggage ){
+				if( !baggage.empty() ){
+					baggage += ',';
+				}
+				baggage.append( key ).append( 1, '=' ).append( value );
+			}
+			res = writer.Set( opentracing::string_view( BaggageHeader.data(), BaggageHeader.size() ), baggage );
+		}
+		return res;
+	}
+
+	// W3C baggage: key1=value1,key2=value2;property
+	static void parseBaggage( opentracing::string_view text, NativeSpanContext & context )
+	{
+		std::string_view	rest( text.data(), text.size() );
+
+		while( !rest.empty() ){
+			const auto			end = rest.find( ',' );
+			std::string_view	item = rest.substr( 0, end );
+			const auto			equal = item.find( '=' );
+
+			rest = end == std::string_view::npos ? std::string_view() : rest.substr( end + 1 );
+			item = item.substr( 0, item.find( ';' ));
+			if( equal != std::string_view::npos && equal < item.size() ){
+				context.mBaggage.emplace_back( trim( item.substr( 0, equal )), trim( item.substr( equal + 1 )));
+			}
+		}
+	}
+
+	static std::string trim( std::string_view text )
+	{
+		while( !text.empty() && ( text.front() == ' ' || text.front() == '\t' )){
+			text.remove_prefix( 1 );
+		}
+		while( !text.empty() && ( text.back() == ' ' || text.back() == '\t' )){
+			text.remove_suffix( 1 );
+		}
+		return std::string( text );
+	}
+
+	opentracing::expected<std::unique_ptr<opentracing::SpanContext>> extractTextMap( const opentracing::TextMapReader & reader ) const
+	{
+		struct Extracted
+		{
+			std::unique_ptr<NativeSpanContext>	mContext = std::make_unique<NativeSpanContext>();
+			TraceParent							mTraceParent;
+			bool								mW3C = false;
+			bool								mFound = false;
+			bool								mCorrupted = false;
+		} extracted;
+
+		// One walk over the headers, cheaper than looking each one up. A single pointer captured, so std::function does not allocate
+		const auto res = reader.ForeachKey( [ state = &extracted ]( opentracing::string_view key, opentracing::string_view value ) -> opentracing::expected<void> {
+			if( equalsNoCase( key, TraceParent::Header )){
+				state->mW3C = state->mTraceParent.parse( std::string_view( value.data(), value.size() ));
+			}else if( equalsNoCase( key, TraceParent::StateHeader )){
+				state->mContext->mTraceState.assign( value.data(), value.size() );
+			}else if( equalsNoCase( key, BaggageHeader )){
+				parseBaggage( value, *state->mContext );
+			}else if( equalsNoCase( key, TraceIdHeader )){
+				state->mFound = true;
+				state->mCorrupted = !state->mContext->parseUberTraceId( value );
+			}else if( key.size() > BaggagePrefix.size() && equalsNoCase( opentracing::string_view( key.data(), BaggagePrefix.size() ), BaggagePrefix )){
+				state->mContext->mBaggage.emplace_back( std::string( key.data() + BaggagePrefix.size(), key.size() - BaggagePrefix.size() ), std::string( value.data(), value.size() ));
+			}
+			return {};
+		});
+		if( !res ){
+			return opentracing::make_unexpected( res.error() );
+		}
+		extracted.mContext->mRemote = true;
+		// traceparent wins when a request has both
+		if( extracted.mW3C ){
+			extracted.mContext->fromTraceParent( extracted.mTraceParent );
+			return std::unique_ptr<opentracing::SpanContext>( std::move( extracted.mContext ));
+		}
+		// A tracestate without its traceparent means nothing
+		extracted.mContext->mTraceState.clear();
+		if( extracted.mCorrupted ){
+			return opentracing::make_unexpected( opentracing::span_context_corrupted_error );
+		}
+		if( !extracted.mFound ){
+			return std::unique_ptr<opentracing::SpanContext>();
+		}
+		return std::unique_ptr<opentracing::SpanContext>( std::move( extracted.mContext ));
+	}
+
+	void realRun()
+	{
+		while( mRunThread.load( std::memory_order_relaxed )){
+			mCompleted.wait( std::chrono::milliseconds( 500 ));
+			exportCompleted();
+		}
+	}
+
+	void exportCompleted()
+	{
+		uint32_t	index;
+
+		do{
+			mBatch.clear();
+			mBatchSlots.clear();
+			while( mBatch.size() < MaxBatch && mCompleted.tryPop( index )){
+				mBatch.push_back( &mSlots[ index ] );
+				mBatchSlots.push_back( index );
+			}
+			if( mBatch.empty() ){
+				break;
+			}
+			if( mLogSpans ){
+				for( const auto span: mBatch ){
+					spdlog::info( "Reporting span {:x}:{:x}:{:x} {} {} us", span->mTraceIdLow, span->mSpanId, span->mParentId, span->mOperation, span->mDurationNs / 1000 );
+				}
+			}
+			if( mExporter ){
+				mExporter->exportSpans( mBatch );
+			}
+			mExported.fetch_add( mBatch.size(), std::memory_order_relaxed );
+			for( const auto slot: mBatchSlots ){
+				mFree.tryPush( uint32_t( slot ));
+			}
+		}while( mBatch.size() == MaxBatch );
+	}
+};
+
+inline void NativeSpan::FinishWithOptions( const opentracing::FinishSpanOptions & options ) noexcept
+{
+	std::lock_guard<std::mutex>	lock( mMutex );
+
+	if( mFinished ){
+		return;
+	}
+	mFinished = true;
+	if( !mData && !mTracer->observer() ){
+		return;
+	}
+	const auto		finish = options.finish_steady_timestamp == opentracing::SteadyTime() ? opentracing::SteadyClock::now() : options.finish_steady_timestamp;
+	const int64_t	durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>( finish - mStart ).count();
+
+	if( mTracer->observer() ){
+		mTracer->observer()->finished( mOperation, durationNs, mError );
+	}
+	if( mData ){
+		mData->mDurationNs = durationNs;
+		for( const auto & [ key, value ]: options.bulk_tags ){
+			if( mData->mTagCount < SpanData::MaxTags && toTag( key, value, mData->mTags[ mData->mTagCount ] )){
+				mData->mTagCount++;
+			}
+		}
+		mTracer->finished( mData, mContext.mSampled );
+		mData = nullptr;
+	}
+}
+
+inline const opentracing::Tracer & NativeSpan::tracer() const noexcept
+{
+	return *mTracer;
+}
+
+// The tracer used by HTTPServer: native records spans itself, jaeger needs jaeger-client-cpp, none records nothing
+enum class TracerType { Native, Jaeger, None };
+
+// Lets cxxopts parse the tracer: native, jaeger or none
+inline std::istream & operator>>( std::istream & in, TracerType & type )
+{
+	std::string text;
+
+	in >> text;
+	if( text == "native" ){
+		type = TracerType::Native;
+	}else if( text == "jaeger" ){
+		type = TracerType::Jaeger;
+	}else if( text == "none" ){
+		type = TracerType::None;
+	}else{
+		in.setstate( std::ios::failbit );
+	}
+	return in;
+}
+
+// Builds with jaeger-client-cpp keep using it and its uber-trace-id header by default, as before the native
+// tracer. The names are the cxxopts defaults of --tracer and --trace-propagation.
+#ifdef JAEGER_ENABLED
+constexpr TracerType			DefaultTracer = TracerType::Jaeger;
+constexpr const char *			DefaultTracerName = "jaeger";
+constexpr PropagationFormat		DefaultPropagation = PropagationFormat::Jaeger;
+constexpr const char *			DefaultPropagationName = "jaeger";
+#else
+constexpr TracerType			DefaultTracer = TracerType::Native;
+constexpr const char *			DefaultTracerName = "native";
+constexpr PropagationFormat		DefaultPropagation = PropagationFormat::W3C;
+constexpr const char *			DefaultPropagationName = "w3c";
+#endif
+
+struct TracerConfig
+{
+	TracerType		mType = DefaultTracer;
+	std::string		mExport = "udp://localhost:6832";		// native: udp://host:port of a Jaeger agent or file://path for OTLP JSON lines
+	size_t			mSlots = 2048;							// native: spans recorded at the same time
+	PropagationFormat	mPropagation = DefaultPropagation;		// headers injected into outgoing requests, both are extracted
+	TailSamplingConfig	mTail;									// native: keep whole traces only if slow or failed
+};
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+// https://github.com/jarro2783/cxxopts
+#include <cxxopts.hpp>
+
+#include "otutils.h"
+#include "worker_pool.h"
+
+namespace utils {
+
+// Options of every service: help, logging, sampling, tracing, threads and shutdown. Each main adds its own ones.
+inline void addCommonOptions( cxxopts::Options & options, LoggerConfig & logConfig, SamplingConfig & samplingConfig, TracerConfig & tracerConfig,
+	ThreadsConfig & threadsConfig, int & drainMs )
+{
+	options.add_options()
+		("help", "Print help")
+		("v,verbose", "Increase log level", cxxopts::value<bool>( logConfig.mVerbose )->default_value("false") )
+		("log-file", "Log file", cxxopts::value<std::string>( logConfig.mLogFile ) )
+		("log-binary", "Write the log file in binary format, read it with logdecoder", cxxopts::value<bool>( logConfig.mBinaryLog )->default_value("false") )
+		("log-binary-level", "Lowest level stored in the binary log, also when the other sinks log less: trace, debug or info", cxxopts::value<std::string>( logConfig.mBinaryLogLevel )->default_value( "info" ) )
+		("log-binary-mb", "Size of the binary log file, older messages are overwritten", cxxopts::value<size_t>( logConfig.mBinaryLogMB )->default_value( "64" ) )
+		("graylog-host", "schema://host:port. Schema is http, udp or tcp. Example: http://localhost:12201", cxxopts::value<std::string>( logConfig.mGraylogHost ) )
+		("graylog-async", "Send Graylog messages in batches from a background thread", cxxopts::value<bool>( logConfig.mGraylog.mAsync )->default_value("false") )
+		("graylog-queue-size", "Max messages waiting to be sent to Graylog", cxxopts::value<size_t>( logConfig.mGraylog.mQueueSize )->default_value( "8192" ) )
+		("graylog-batch-size", "Messages sent to Graylog per batch", cxxopts::value<size_t>( logConfig.mGraylog.mBatchSize )->default_value( "64" ) )
+		("graylog-flush-ms", "Max time a message waits in the queue before sending a partial batch", cxxopts::value<int>( logConfig.mGraylog.mFlushIntervalMs )->default_value( "200" ) )
+		("graylog-overflow", "When the queue is full: block, drop-oldest or drop-by-level", cxxopts::value<utils::OverflowPolicy>( logConfig.mGraylog.mOverflow )->default_value( "drop-by-level" ) )
+		("graylog-chunk-size", "Max UDP datagram size, bigger messages are chunked", cxxopts::value<size_t>( logConfig.mGraylog.mChunkSize )->default_value( "1420" ) )
+		("graylog-compress", "Compress UDP messages with zlib", cxxopts::value<bool>( logConfig.mGraylog.mCompress )->default_value("false") )
+		("graylog-spill-file", "File to keep messages while Graylog is unreachable or the queue is full, instead of --graylog-overflow. Enables --graylog-async", cxxopts::value<std::string>( logConfig.mGraylog.mSpillFile ) )
+		("graylog-spill-max-mb", "Max size of the spill file", cxxopts::value<size_t>( logConfig.mGraylog.mSpillMaxMB )->default_value( "64" ) )
+		("graylog-replay-rate", "Spilled messages replayed per second once Graylog is back", cxxopts::value<int>( logConfig.mGraylog.mReplayRate )->default_value( "500" ) )
+		("log-rate", "Max messages per second logged by each error statement, 0 for no limit", cxxopts::value<double>( logConfig.mLimits.mRate )->default_value( "0" ) )
+		("log-burst", "Messages logged in a row by an error statement before --log-rate applies", cxxopts::value<double>( logConfig.mLimits.mBurst )->default_value( "20" ) )
+		("log-tail", "Keep the debug messages of each request, log them only if it fails or is slow", cxxopts::value<bool>( logConfig.mTail.mEnabled )->default_value("false") )
+		("log-tail-slow-ms", "Requests slower than this log their debug messages with --log-tail", cxxopts::value<int>( logConfig.mTail.mSlowMs )->default_value( "1000" ) )
+		("log-tail-max-kb", "Max debug messages kept per request with --log-tail", cxxopts::value<size_t>( logConfig.mTail.mMaxKB )->default_value( "64" ) )
+		("log-sink-queue", "Messages queued per log sink, each sink is written from its own thread. 0 writes them from the caller thread", cxxopts::value<size_t>( logConfig.mSinkQueueSize )->default_value( "8192" ) )
+		("log-sampled-debug", "Requests whose trace is sampled log their debug messages", cxxopts::value<bool>( logConfig.mSampledDebug )->default_value("false") )
+		("trace-sampler", "New traces sampled by: const, probabilistic, ratelimiting or adaptive", cxxopts::value<utils::SamplerType>( samplingConfig.mType )->default_value( "const" ) )
+		("trace-sampler-param", "const: 1 all, 0 none. probabilistic: probability. ratelimiting: traces per second. adaptive: target traces per second of each route", cxxopts::value<double>( samplingConfig.mParam )->default_value( "1" ) )
+		("trace-log-spans", "Log every finished span", cxxopts::value<bool>( samplingConfig.mLogSpans )->default_value("false") )
+		("tracer", "native, jaeger (needs jaeger-client-cpp, the default when built with it) or none", cxxopts::value<utils::TracerType>( tracerConfig.mType )->default_value( utils::DefaultTracerName ) )
+		("trace-export", "Where the native tracer sends spans: udp://host:port of a Jaeger agent or file://path for OTLP JSON lines", cxxopts::value<std::string>( tracerConfig.mExport )->default_value( "udp://localhost:6832" ) )
+		("trace-slots", "Spans the native tracer records at the same time, new spans are dropped when all are in use", cxxopts::value<size_t>( tracerConfig.mSlots )->default_value( "2048" ) )
+		("trace-propagation", "Trace context sent to other services: w3c (traceparent) or jaeger (uber-trace-id). Both are accepted. Defaults to jaeger when built with jaeger-client-cpp", cxxopts::value<utils::PropagationFormat>( tracerConfig.mPropagation )->default_value( utils::DefaultPropagationName ) )
+		("io-threads", "cpprest threads that accept, read and reply requests, 0 for its default", cxxopts::value<size_t>( threadsConfig.mIOThreads )->default_value( "0" ) )
+		("worker-threads", "Threads that run the handlers, so the ones waiting for other services do not hold cpprest threads. 0 runs them on the cpprest threads", cxxopts::value<size_t>( threadsConfig.mWorkerThreads )->default_value( "0" ) )
+		("pin-threads", "Pin each thread to a CPU", cxxopts::value<bool>( threadsConfig.mPin )->default_value("false") )
+		("listeners", "Processes serving the port with SO_REUSEPORT, each with its own threads. Linux only", cxxopts::value<size_t>( threadsConfig.mListeners )->default_value( "1" ) )
+		("drain-ms", "On SIGINT or SIGTERM, time the requests in flight have to finish after leaving Consul", cxxopts::value<int>( drainMs )->default_value( "10000" ) );
+}
+
+}
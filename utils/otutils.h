@@ -9,16 +9,16 @@
 #include <cpprest/http_listener.h>
 #include <cpprest/json.h>
 
-#ifdef _JAEGER_ENABLED
+#ifdef JAEGER_ENABLED
 // https://www.jaegertracing.io
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 #include <jaegertracing/Tracer.h>
 #pragma GCC diagnostic pop
-#else
+#endif
 #include <opentracing/tracer.h>
 #include <opentracing/span.h>
-#endif
+#include <opentracing/ext/tags.h>
 
 #include <yaml-cpp/yaml.h>
 
@@ -28,36 +28,128 @@
 
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/rotating_file_sink.h>
-#include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/sinks/base_sink.h>
 
 #include <chrono>
 
+#include "log_queue.h"
+#include "gelf_transport.h"
+#include "gelf_encoder.h"
+#include "spill_file.h"
+#include "log_limiter.h"
+#include "log.h"
+#include "log_metrics.h"
+#include "fanout_sink.h"
+#include "console_sink.h"
+#include "sampler.h"
+#include "native_tracer.h"
+
 namespace utils {
 
-static const std::string defaultOpenTracingConfig = "\
+// Jaeger configuration. New traces are sampled by TraceSampler, so the Jaeger sampler keeps every span
+// and the ones not sampled are marked with sampling.priority 0.
+inline std::string openTracingConfig( const SamplingConfig & config, PropagationFormat propagation )
+{
+	return fmt::format( "\
 disabled: false\n\
+propagation_format: {}\n\
 reporter:\n\
-    logSpans: true\n\
+    logSpans: {}\n\
 sampler:\n\
   type: const\n\
-  param: 1";
+  param: 1", propagation == PropagationFormat::W3C ? "w3c" : "jaeger", config.mLogSpans );
+}
 
+// Only shows the tracer the headers used to propagate the context. Keys and values are views over the
+// request headers, except in UTF-16 builds, where they have to be converted.
 class CPPRestHeaderReader: public opentracing::HTTPHeadersReader
 {
 public:
 	explicit CPPRestHeaderReader( const web::http::http_request & request ) : mRequest( request ) {}
 
+	opentracing::expected<opentracing::string_view> LookupKey( opentracing::string_view key ) const override
+	{
+#ifdef _UTF16_STRINGS
+		( void )key;
+		return opentracing::make_unexpected( opentracing::lookup_key_not_supported_error );
+#else
+		const auto iter = mRequest.headers().find( utility::string_t( key.data(), key.size() ));
+
+		if( iter == mRequest.headers().end() ){
+			return opentracing::make_unexpected( opentracing::key_not_found_error );
+		}
+		return opentracing::string_view( iter->second.data(), iter->second.size() );
+#endif
+	}
+
 	opentracing::expected<void> ForeachKey( std::function<opentracing::expected<void>(opentracing::string_view key, opentracing::string_view value)> f) const override
 	{
-		for( auto iter: mRequest.headers() ){
-			f( utility::conversions::to_utf8string( iter.first ), utility::conversions::to_utf8string( iter.second ) );
+		for( const auto & [ name, value ]: mRequest.headers() ){
+			if( name.empty() ){
+				continue;
+			}
+			const auto first = std::tolower( static_cast<unsigned char>( name[0] ));
+
+			// cpprest sorts the headers ignoring case: none of ours is after "u"
+			if( first > 'u' ){
+				break;
+			}
+			if( isPropagationHeader( first, name )){
+#ifdef _UTF16_STRINGS
+				const auto res = f( utility::conversions::to_utf8string( name ), utility::conversions::to_utf8string( value ));
+#else
+				const auto res = f( opentracing::string_view( name.data(), name.size() ), opentracing::string_view( value.data(), value.size() ));
+#endif
+				if( !res ){
+					return res;
+				}
+			}
 		}
 		return {};
 	}
 
 private:
 	const web::http::http_request & mRequest;
+
+	static bool startsWithNoCase( const utility::string_t & name, std::string_view prefix )
+	{
+		if( name.size() < prefix.size() ){
+			return false;
+		}
+		for( size_t i = 0; i < prefix.size(); i++ ){
+			if( std::tolower( static_cast<unsigned char>( name[i] )) != prefix[i] ){
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static bool equalsNoCase( const utility::string_t & name, std::string_view text )
+	{
+		return name.size() == text.size() && startsWithNoCase( name, text );
+	}
+
+	// Jaeger: uber-trace-id, uberctx-{key}, jaeger-debug-id and jaeger-baggage. W3C: traceparent, tracestate and baggage
+	static bool isPropagationHeader( int first, const utility::string_t & name )
+	{
+		switch( first )
+		{
+			case 'u' :
+				return equalsNoCase( name, "uber-trace-id" ) || ( name.size() > 8 && startsWithNoCase( name, "uberctx-" ));
+
+			case 't' :
+				return equalsNoCase( name, "traceparent" ) || equalsNoCase( name, "tracestate" );
+
+			case 'j' :
+				return equalsNoCase( name, "jaeger-debug-id" ) || equalsNoCase( name, "jaeger-baggage" );
+
+			case 'b' :
+				return equalsNoCase( name, "baggage" );
+
+			default :
+				return false;
+		}
+	}
 };
 
 class CPPRestHeaderWriter: public opentracing::HTTPHeadersWriter
@@ -75,124 +167,558 @@ private:
 	web::http::http_request & mRequest;
 };
 
+// Whether the span is recorded. Tags of spans that are not can be skipped.
+inline bool isSampled( const opentracing::SpanContext & spanContext )
+{
+	if( const auto nativeContext = dynamic_cast<const NativeSpanContext *>( &spanContext )){
+		return nativeContext->mSampled;
+	}
+#ifdef JAEGER_ENABLED
+	const auto jaegerContext = dynamic_cast<const jaegertracing::SpanContext *>( &spanContext );
+
+	return jaegerContext && jaegerContext->isSampled();
+#else
+	// The no-op tracer records nothing
+	return false;
+#endif
+}
+
+// Makes the ids of the span the ones of the messages logged from this thread, see LogContext
+inline void setLogContext( const opentracing::SpanContext & spanContext )
+{
+	if( const auto native = dynamic_cast<const NativeSpanContext *>( &spanContext ); native ){
+		LogContext::current().set( native->mTraceIdHigh, native->mTraceIdLow, native->mSpanId );
+	}else{
+		const auto traceId = spanContext.ToTraceID();
+
+		if( traceId.empty() ){
+			LogContext::current().clear();
+		}else{
+			LogContext::current().set( traceId, spanContext.ToSpanID() );
+		}
+	}
+}
+
 std::unique_ptr<opentracing::Span> newSpan( const web::http::http_request & request, const std::string & name )
 {
 	std::unique_ptr<opentracing::Span>	span;
 	auto								parentContext = opentracing::Tracer::Global()->Extract( CPPRestHeaderReader( request ) );
 
-	if( parentContext ){
+	if( parentContext && parentContext.value() ){
+		// The caller already decided if the trace is sampled
 		span = opentracing::Tracer::Global()->StartSpan( name, { opentracing::ChildOf( parentContext.value().get() ) } );
-	}else{
+	}else if( TraceSampler::instance().sample( name )){
 		span = opentracing::Tracer::Global()->StartSpan( name );
+	}else{
+		// Decided before the span starts, so the native tracer does not record it
+		span = opentracing::Tracer::Global()->StartSpan( name, { opentracing::SetTag( opentracing::ext::sampling_priority, 0 ) } );
+		// Tracers that only honour the tag once the span exists
+		if( isSampled( span->context() )){
+			span->SetTag( opentracing::ext::sampling_priority, 0 );
+		}
 	}
-	// https://opentracing.io/specification/conventions/
-	span->SetTag( "http.method", utility::conversions::to_utf8string( request.method() ));
-	span->SetTag( "http.url", utility::conversions::to_utf8string( request.absolute_uri().to_string() ));
+	setLogContext( span->context() );
+	if( isSampled( span->context() )){
+		RequestLogLevel::sampled();
+		// https://opentracing.io/specification/conventions/
+		// The method is usually one of tags::Interned, and the tracer copies what is not, so no copies here
+#ifdef _UTF16_STRINGS
+		span->SetTag( tags::HTTPMethod, utility::conversions::to_utf8string( request.method() ));
+		span->SetTag( tags::HTTPURL, utility::conversions::to_utf8string( request.absolute_uri().to_string() ));
+#else
+		const auto & method = request.method();
+		const auto url = request.absolute_uri().to_string();
 
+		span->SetTag( tags::HTTPMethod, opentracing::string_view( method.data(), method.size() ));
+		span->SetTag( tags::HTTPURL, opentracing::string_view( url.data(), url.size() ));
+#endif
+	}
 	return span;
 }
 
+// Sets http.status_code, and error for 4xx and 5xx. Error is set also if the span is not sampled, for the metrics.
+inline void setHTTPStatus( opentracing::Span & span, web::http::status_code status )
+{
+	if( status >= 400 ){
+		span.SetTag( tags::Error, true );
+	}
+	if( isSampled( span.context() )){
+		span.SetTag( tags::HTTPStatusCode, status );
+	}
+}
+
 void injectContext( const opentracing::SpanContext & spanContext, web::http::http_request & request )
 {
 	opentracing::Tracer::Global()->Inject( spanContext, utils::CPPRestHeaderWriter( request ) );
 }
 
+// Client span of an outbound http_client call, child of the span of the request being served.
+// Records when each phase of the call happens as a span event: request sent, headers received and
+// body parsed. The clients keep their connections between calls, so there is no connect phase.
+// A phase is one read of the steady clock, the events are logged when the span finishes.
+class ClientSpan
+{
+public:
+	enum Phase { RequestSent, HeadersReceived, BodyParsed, PhaseCount };
+
+	// Injects the context of the new span into request
+	ClientSpan( const std::string & operation, const opentracing::SpanContext & parent, const char * peer, web::http::http_request & request )
+		: mStartSystem( opentracing::SystemClock::now() )
+		, mStartSteady( opentracing::SteadyClock::now() )
+	{
+		mSpan = opentracing::Tracer::Global()->StartSpan( operation, { opentracing::ChildOf( &parent ), opentracing::StartTimestamp( mStartSystem, mStartSteady ) } );
+		injectContext( mSpan->context(), request );
+		if( !isSampled( mSpan->context() )){
+			return;
+		}
+		mSpan->SetTag( tags::SpanKind, tags::Client );
+		mSpan->SetTag( tags::PeerService, peer );
+
+		// The callback runs in the threads of the client, and may outlive this span if the call is abandoned
+		mPhases = std::make_shared<Phases>();
+		// Without a body the client reports the upload once, when the request is written
+		request.set_progress_handler( [ phases = mPhases ]( web::http::message_direction::direction direction, utility::size64_t ){
+			if( direction == web::http::message_direction::upload ){
+				phases->mark( RequestSent );
+			}
+		});
+	}
+
+	~ClientSpan()
+	{
+		finish();
+	}
+
+	void phase( Phase phase )
+	{
+		if( mPhases ){
+			mPhases->mark( phase );
+		}
+	}
+
+	// The call failed without a response
+	void setError()
+	{
+		mSpan->SetTag( tags::Error, true );
+	}
+
+	opentracing::Span & span()
+	{
+		return *mSpan;
+	}
+
+	void finish()
+	{
+		if( mFinished ){
+			return;
+		}
+		mFinished = true;
+		if( mPhases ){
+			static constexpr const char *	Names[ PhaseCount ] = { tags::RequestSent, tags::HeadersReceived, tags::BodyParsed };
+
+			for( int i = 0; i < PhaseCount; i++ ){
+				const int64_t ns = mPhases->mNs[i].load( std::memory_order_relaxed );
+
+				if( ns != 0 ){
+					const auto timestamp = mStartSystem + std::chrono::duration_cast<opentracing::SystemClock::duration>( std::chrono::nanoseconds( ns ) - mStartSteady.time_since_epoch() );
+
+					mSpan->Log( timestamp, { { tags::Event, Names[i] } } );
+				}
+			}
+		}
+		mSpan->Finish();
+	}
+
+private:
+	struct Phases
+	{
+		std::atomic<int64_t>	mNs[ PhaseCount ] = {};		// steady clock, 0 until the phase happens
+
+		void mark( Phase phase )
+		{
+			mNs[ phase ].store( std::chrono::duration_cast<std::chrono::nanoseconds>( opentracing::SteadyClock::now().time_since_epoch() ).count(), std::memory_order_relaxed );
+		}
+	};
+
+	std::unique_ptr<opentracing::Span>	mSpan;
+	const opentracing::SystemTime		mStartSystem;
+	const opentracing::SteadyTime		mStartSteady;
+	std::shared_ptr<Phases>				mPhases;
+	bool								mFinished = false;
+};
+
+struct GraylogConfig
+{
+	bool						mAsync = false;
+	size_t						mQueueSize = 8192;
+	size_t						mBatchSize = 64;
+	int							mFlushIntervalMs = 200;
+	OverflowPolicy				mOverflow = OverflowPolicy::DropByLevel;
+	spdlog::level::level_enum	mDropLevel = spdlog::level::info;
+	size_t						mChunkSize = 1420;		// udp:// datagram size, bigger messages are chunked
+	bool						mCompress = false;		// zlib compression for udp://
+	std::string					mSpillFile;				// when set, messages that can not be sent or queued are kept here, in order. Implies mAsync
+	size_t						mSpillMaxMB = 64;
+	int							mReplayRate = 500;		// spilled messages replayed per second once the backend recovers
+};
+
 template<typename Mutex>
 class graylog_sink : public spdlog::sinks::base_sink<Mutex>
 {
 public:
-	graylog_sink( const std::string & hostName, const std::string & graylogHost ) 
-		: mHostName( hostName )
+	graylog_sink( const std::string & hostName, const std::string & graylogHost, const GraylogConfig & config = {} ) 
+		: mEncoder( hostName )
+		, mConfig( config )
 	{
-		mGraylogService = fmt::format( "{}/gelf", graylogHost );
+		mTransport = newGelfTransport( graylogHost, mConfig.mChunkSize, mConfig.mCompress );
+		if( !mTransport ){
+			mGraylogService = fmt::format( "{}/gelf", graylogHost );
+		}else{
+			mGraylogService = graylogHost;
+		}
+		if( !mConfig.mSpillFile.empty() ){
+			mSpill = std::make_unique<SpillFile>( mConfig.mSpillFile, mConfig.mSpillMaxMB * 1048576 );
+			mConfig.mAsync = true;
+		}
+		if( mConfig.mAsync ){
+			if( !mTransport ){
+				mClient = std::make_unique<web::http::client::http_client>( utility::conversions::to_string_t(mGraylogService) );
+			}
+			mQueue = std::make_unique<LogQueue<Message>>( mConfig.mQueueSize, mConfig.mOverflow, mConfig.mDropLevel );
+			if( mSpill ){
+				// A full queue goes to the spill file, with the queued messages before the new one
+				mQueue->setOverflow([ this ]( Message & message, spdlog::level::level_enum level ){ spill( message, level ); });
+			}
+			mWorker = std::thread( &graylog_sink::realRun, this );
+		}
 	}
 
-protected:
-	void sink_it_(const spdlog::details::log_msg& msg) override
+	~graylog_sink() override
 	{
-		if( msg.level != spdlog::level::level_enum::off ){
-			web::json::value 				logJSON;
+		if( mQueue ){
+			mQueue->close();
+			mWorker.join();
+		}
+	}
 
-			logJSON[U("version")] = web::json::value::string( U("1.1") );
-			logJSON[U("host")] = web::json::value::string( utility::conversions::to_string_t(mHostName ));
-			logJSON[U("short_message")] = web::json::value::string( utility::conversions::to_string_t(fmt::format( msg.payload ) ));
-			logJSON[U("timestamp")] = web::json::value::number( std::chrono::duration_cast<std::chrono::milliseconds>( msg.time.time_since_epoch() ).count() / 1000.0 );
-			logJSON[U("level")] = web::json::value::number( toLevel( msg.level ) );
+	GraylogStats stats() const
+	{
+		GraylogStats res;
 
-			web::http::client::http_client 	client( utility::conversions::to_string_t(mGraylogService) );
-			web::http::http_request			req( web::http::methods::POST );
+		if( mQueue ){
+			res.mQueueDepth = mQueue->depth();
+			res.mDropped = mQueue->dropped();
+		}
+		if( mSpill ){
+			res.mSpillPendingBytes = mSpill->pendingBytes();
+			res.mSpillDropped = mSpill->dropped();
+		}
+		res.mSent = mSent;
+		res.mFailed = mFailed;
 
-			req.headers().set_content_type( U("application/json; charset=utf-8") );
-			req.set_body( logJSON );
+		return res;
+	}
 
-			auto response = client.request( req ).get();
-			if( response.status_code() != web::http::status_codes::OK && response.status_code() != web::http::status_codes::Accepted ){
-				spdlog::error("Error writting to graylog. Service: {}, error: {}", mGraylogService, response.status_code() );
+protected:
+	void sink_it_(const spdlog::details::log_msg& msg) override
+	{
+		if( msg.level != spdlog::level::level_enum::off ){
+			// Reused by every message logged from this thread
+			static thread_local fmt::memory_buffer	buffer;
+
+			mEncoder.encode( msg, buffer );
+			if( mQueue ){
+				mQueue->push({ fmt::to_string( buffer ), msg.level }, msg.level );
+			}else if( mTransport ){
+				if( mTransport->send( std::string_view( buffer.data(), buffer.size() ))){
+					mSent++;
+				}else{
+					mFailed++;
+				}
+			}else{
+				web::http::client::http_client 	client( utility::conversions::to_string_t(mGraylogService) );
+				web::http::http_request			req( web::http::methods::POST );
+
+				req.set_body( fmt::to_string( buffer ), "application/json; charset=utf-8" );
+
+				auto response = client.request( req ).get();
+				if( response.status_code() != web::http::status_codes::OK && response.status_code() != web::http::status_codes::Accepted ){
+					mFailed++;
+					spdlog::error("Error writting to graylog. Service: {}, error: {}", mGraylogService, response.status_code() );
+				}else{
+					mSent++;
+				}
 			}
 		}
 	}
 
 	void flush_() override 
 	{
+		if( mQueue ){
+			mQueue->flush( std::chrono::milliseconds( mConfig.mFlushIntervalMs * 10 ));
+		}
 	}
 
 private:
-	std::string			mHostName;
-	std::string			mGraylogService;
+	// The level is kept for the spill file
+	struct Message
+	{
+		std::string					mBody;
+		spdlog::level::level_enum	mLevel;
+	};
+
+	GelfEncoder								mEncoder;
+	std::string								mGraylogService;
+	GraylogConfig							mConfig;
+	std::unique_ptr<GelfTransport>			mTransport;
+	std::unique_ptr<web::http::client::http_client>	mClient;
+	std::unique_ptr<LogQueue<Message>>		mQueue;
+	std::unique_ptr<SpillFile>				mSpill;
+	std::thread								mWorker;
+	std::atomic<uint64_t>					mSent{ 0 };
+	std::atomic<uint64_t>					mFailed{ 0 };
+	std::atomic<bool>						mBackendUp{ true };
+	std::chrono::steady_clock::time_point	mNextProbe;
+	std::chrono::steady_clock::time_point	mLastReplay;
+	double									mReplayBudget = 0;
+	std::string								mReplayMessage;
+
+	// The spill file keeps the order of the messages: once one is spilled, the ones after it follow until the
+	// file is replayed. Queued messages are spilled under the queue lock, by this thread or by a logging thread
+	// that finds the queue full. Only the rest of a batch that fails while the queue overflows can land after
+	// newer messages.
+	void realRun()
+	{
+		const std::chrono::milliseconds				timeout( mConfig.mFlushIntervalMs );
+		const typename LogQueue<Message>::Handler	spillAll = [ this ]( Message & message, spdlog::level::level_enum level ){ spill( message, level ); };
+		std::vector<Message>						batch;
+
+		batch.reserve( mConfig.mBatchSize );
+		while( true ){
+			if( spilling() ){
+				if( !mQueue->takeAll( spillAll, mConfig.mBatchSize, timeout )){
+					break;
+				}
+			}else{
+				if( !mQueue->popBatch( batch, mConfig.mBatchSize, timeout )){
+					break;
+				}
+				const size_t	count = batch.size();
+				const size_t	sent = sendBatch( batch );
+
+				if( mSpill && sent < count ){
+					backendDown();
+					for( size_t i = sent; i < count; i++ ){
+						spill( batch[i], batch[i].mLevel );
+					}
+				}
+				mQueue->done( count );
+				batch.clear();
+			}
+			if( mSpill ){
+				replay();
+			}
+		}
+	}
+
+	void spill( const Message & message, spdlog::level::level_enum level )
+	{
+		mSpill->append( message.mBody, level );
+	}
 
-	int toLevel( spdlog::level::level_enum level ){
-		int grayLevel = 1;
+	bool spilling() const
+	{
+		return mSpill && ( !mBackendUp || !mSpill->empty() );
+	}
 
-		switch( level )
-		{
-			case spdlog::level::level_enum::trace :
-				grayLevel = 7;
-			break;
+	// Returns how many messages, from the first, were sent. Messages that were not are moved to the end of batch.
+	size_t sendBatch( std::vector<Message> & batch )
+	{
+		if( mTransport ){
+			for( size_t i = 0; i < batch.size(); i++ ){
+				if( !send( batch[i].mBody )){
+					return i;
+				}
+			}
+			return batch.size();
+		}
+		// GELF HTTP takes one message per request: a batch reuses the client connection and sends its requests concurrently
+		std::vector<pplx::task<void>>	requests;
+		std::vector<char>				sent( batch.size(), 0 );
+
+		for( size_t i = 0; i < batch.size(); i++ ){
+			web::http::http_request		req( web::http::methods::POST );
 
-			case spdlog::level::level_enum::debug :
-				grayLevel = 7;
-			break;
+			req.set_body( batch[i].mBody, "application/json; charset=utf-8" );
+			requests.push_back( mClient->request( req ).then([ this, &sent, i ]( pplx::task<web::http::http_response> previousTask ){
+				sent[i] = checkResponse( previousTask );
+			}));
+		}
+		if( !requests.empty() ){
+			pplx::when_all( requests.begin(), requests.end() ).wait();
+		}
+		// Sent concurrently, the ones that failed keep their relative order
+		std::vector<Message>	failed;
+		size_t					res = 0;
+
+		for( size_t i = 0; i < batch.size(); i++ ){
+			if( sent[i] ){
+				res++;
+			}else{
+				failed.push_back( std::move( batch[i] ));
+			}
+		}
+		std::move( failed.begin(), failed.end(), batch.begin() + res );
+		return res;
+	}
 
-			case spdlog::level::level_enum::info :
-				grayLevel = 6;
-			break;
+	bool send( std::string_view body )
+	{
+		bool res = false;
+
+		if( mTransport ){
+			res = mTransport->send( body );
+			if( res ){
+				mSent++;
+			}else{
+				mFailed++;
+			}
+		}else{
+			web::http::http_request		req( web::http::methods::POST );
 
-			case spdlog::level::level_enum::warn :
-				grayLevel = 4;
-			break;
+			req.set_body( std::string( body ), "application/json; charset=utf-8" );
+			mClient->request( req ).then([ this, &res ]( pplx::task<web::http::http_response> previousTask ){
+				res = checkResponse( previousTask );
+			}).wait();
+		}
+		return res;
+	}
 
-			case spdlog::level::level_enum::err :
-				grayLevel = 3;
-			break;
+	bool checkResponse( pplx::task<web::http::http_response> & responseTask )
+	{
+		try{
+			const auto response = responseTask.get();
 
-			case spdlog::level::level_enum::critical :
-				grayLevel = 2;
-			break;
+			if( response.status_code() == web::http::status_codes::OK || response.status_code() == web::http::status_codes::Accepted ){
+				mSent++;
+				return true;
+			}
+			spdlog::error("Error writting to graylog. Service: {}, error: {}", mGraylogService, response.status_code() );
+		}catch( const std::exception & e ){
+			spdlog::error("Error writting to graylog. Service: {}, error: {}", mGraylogService, e.what() );
+		}
+		mFailed++;
+		return false;
+	}
 
-			default:
-			break;			
+	void backendDown()
+	{
+		if( mBackendUp ){
+			spdlog::warn( "Graylog service {} unreachable, spilling messages to {}", mGraylogService, mConfig.mSpillFile );
+		}
+		mBackendUp = false;
+		mNextProbe = std::chrono::steady_clock::now() + std::chrono::seconds( 1 );
+	}
+
+	// Sends spilled messages, oldest first, at mReplayRate messages per second at most.
+	// While the backend is down, a single message is tried every second.
+	void replay()
+	{
+		const auto					now = std::chrono::steady_clock::now();
+		const double				elapsed = std::chrono::duration<double>( now - mLastReplay ).count();
+		spdlog::level::level_enum	level;
+
+		mLastReplay = now;
+		if( !mBackendUp && now < mNextProbe ){
+			return;
+		}
+		mReplayBudget = std::min<double>( mConfig.mReplayRate, mReplayBudget + elapsed * mConfig.mReplayRate );
+		if( !mBackendUp ){
+			mReplayBudget = std::max( mReplayBudget, 1.0 );
+		}
+		while( mReplayBudget >= 1.0 && mSpill->front( mReplayMessage, level )){
+			if( !send( mReplayMessage )){
+				backendDown();
+				return;
+			}
+			if( !mBackendUp ){
+				spdlog::info( "Graylog service {} is back, replaying {} spilled bytes", mGraylogService, mSpill->pendingBytes() );
+				mBackendUp = true;
+			}
+			mSpill->pop();
+			mReplayBudget -= 1.0;
+		}
+		if( mSpill->empty() ){
+			mBackendUp = true;
 		}
-		return grayLevel;
 	}
 };
 
-std::shared_ptr<spdlog::logger> newLogger( const std::string & appName, bool verbose, const std::string & logFile, const std::string & graylogHost )
+struct LoggerConfig
 {
-	std::shared_ptr<spdlog::logger> 	res;
-	std::vector<spdlog::sink_ptr> 		sinks;
+	bool			mVerbose = false;
+	std::string		mLogFile;
+	std::string		mGraylogHost;
+	bool			mBinaryLog = false;		// write mLogFile in the binary format read by logdecoder
+	size_t			mBinaryLogMB = 64;
+	std::string		mBinaryLogLevel = "info";	// lowest level stored in the binary log, mVerbose lowers it to debug
+	GraylogConfig	mGraylog;
+	LogLimitConfig	mLimits;
+	TailLogConfig	mTail;			// used by HTTPServer
+	bool			mSampledDebug = false;	// requests whose trace is sampled log their debug messages, used by HTTPServer
+	size_t			mSinkQueueSize = 8192;	// each sink is written from its own thread. 0 to write them from the caller
+};
 
-	sinks.push_back( std::make_shared<spdlog::sinks::stdout_color_sink_st>() );
-	if( !logFile.empty() ){
-		sinks.push_back( std::make_shared<spdlog::sinks::rotating_file_sink_mt>( logFile, 1048576 * 5, 3 ) );
+std::shared_ptr<spdlog::logger> newLogger( const std::string & appName, const LoggerConfig & config )
+{
+	std::shared_ptr<spdlog::logger> 						res;
+	std::vector<std::pair<std::string, spdlog::sink_ptr>>	sinks;
+
+	sinks.emplace_back( "console", std::make_shared<console_sink>() );
+	sinks.back().second->set_formatter( newTraceFormatter() );
+	if( !config.mLogFile.empty() ){
+		if( config.mBinaryLog ){
+			// Statements below the logger level but not below this one are stored without formatting them
+			const auto	level = spdlog::level::from_str( config.mBinaryLogLevel );
+			auto 		binaryLog = std::make_shared<BinaryLog>( config.mLogFile, config.mBinaryLogMB * 1048576, appName, config.mVerbose ? std::min( level, spdlog::level::debug ) : level );
+			BinaryLog::activate( binaryLog );
+			sinks.emplace_back( "binary-file", std::make_shared<binary_log_sink<spdlog::details::null_mutex>>( binaryLog ));
+		}else{
+			sinks.emplace_back( "file", std::make_shared<spdlog::sinks::rotating_file_sink_mt>( config.mLogFile, 1048576 * 5, 3 ) );
+			sinks.back().second->set_formatter( newTraceFormatter() );
+		}
+	}
+	if( !config.mGraylogHost.empty() ){
+		auto graylog = std::make_shared<graylog_sink<spdlog::details::null_mutex>>( appName, config.mGraylogHost, config.mGraylog );
+
+		LogMetrics::instance().setGraylog([ weak = std::weak_ptr( graylog ) ](){
+			const auto sink = weak.lock();
+
+			return sink ? sink->stats() : GraylogStats();
+		});
+		sinks.emplace_back( "graylog", graylog );
 	}
-	if( !graylogHost.empty() ){
-		sinks.push_back( std::make_shared<graylog_sink<spdlog::details::null_mutex>>( appName, graylogHost ) );
+	if( config.mSinkQueueSize > 0 ){
+		auto fanout = std::make_shared<fanout_sink>( sinks, config.mSinkQueueSize );
+
+		LogMetrics::instance().setFanout([ weak = std::weak_ptr( fanout ) ](){
+			const auto sink = weak.lock();
+
+			return sink ? sink->stats() : FanoutStats();
+		});
+		res = std::make_shared<spdlog::logger>( appName, fanout );
+	}else{
+		res = std::make_shared<spdlog::logger>( appName );
+		for( const auto & sink: sinks ){
+			res->sinks().push_back( sink.second );
+		}
 	}
-	res = std::make_shared<spdlog::logger>( appName, sinks.begin(), sinks.end() );
 
-	if( verbose ){
+	if( config.mVerbose ){
 		res->set_level( spdlog::level::debug );
 	}
+	LogLimits::instance().start( res, config.mLimits );
+
 	return res;
 }
 
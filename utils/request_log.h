@@ -0,0 +1,178 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "binlog.h"
+
+namespace utils {
+
+struct TailLogConfig
+{
+	bool						mEnabled = false;
+	spdlog::level::level_enum	mLevel = spdlog::level::debug;	// lowest level kept in the request buffer
+	int							mSlowMs = 1000;					// requests slower than this are logged even if they succeed
+	size_t						mMaxKB = 64;					// per request, later messages are counted but not kept
+};
+
+// Messages of a single request that are below the logger level. They are kept in memory while the request
+// is running and are sent to the logger sinks, by flush(), only if the request fails or is slow.
+// The LOG_xxx macros write into the buffer of the current thread, set with RequestLog::Scope.
+class RequestLog
+{
+public:
+	void reset( spdlog::level::level_enum level, size_t maxBytes )
+	{
+		mLevel = level;
+		mMaxBytes = maxBytes;
+		mDropped = 0;
+		mRecords.clear();
+		mText.clear();
+	}
+
+	// Returns the buffer of the request being handled by this thread, if it keeps messages at this level
+	static RequestLog * capturing( spdlog::level::level_enum level )
+	{
+		RequestLog * requestLog = tCurrent;
+
+		return requestLog && level >= requestLog->mLevel ? requestLog : nullptr;
+	}
+
+	template<typename... Args>
+	void add( spdlog::level::level_enum level, spdlog::source_loc location, spdlog::format_string_t<Args...> format, Args &&... args )
+	{
+		if( mText.size() >= mMaxBytes ){
+			mDropped++;
+		}else{
+			const size_t begin = mText.size();
+
+			fmt::format_to( std::back_inserter( mText ), format, std::forward<Args>( args )... );
+			mRecords.push_back({ level, spdlog::log_clock::now(), location, begin, mText.size() });
+		}
+	}
+
+	size_t size() const
+	{
+		return mRecords.size();
+	}
+
+	uint64_t dropped() const
+	{
+		return mDropped;
+	}
+
+	// Sends the kept messages, with their original time, to the sinks of the logger
+	void flush( spdlog::logger & logger ) const
+	{
+		const std::string_view	text( mText.data(), mText.size() );
+
+		for( const auto & record: mRecords ){
+			const spdlog::details::log_msg	msg( record.mTime, record.mLocation, logger.name(), record.mLevel, text.substr( record.mBegin, record.mEnd - record.mBegin ));
+
+			// The binary log already has the messages at its level
+			BinaryLog::tSkipText = BinaryLog::enabled( record.mLevel ) != nullptr;
+			for( auto & sink: logger.sinks() ){
+				if( sink->should_log( record.mLevel )){
+					sink->log( msg );
+				}
+			}
+			BinaryLog::tSkipText = false;
+		}
+	}
+
+	// Makes requestLog the buffer of the current thread while the scope is alive
+	class Scope
+	{
+	public:
+		explicit Scope( RequestLog * requestLog ) : mPrevious( tCurrent )
+		{
+			tCurrent = requestLog;
+		}
+
+		~Scope()
+		{
+			tCurrent = mPrevious;
+		}
+
+		Scope( const Scope & ) = delete;
+		Scope & operator=( const Scope & ) = delete;
+
+	private:
+		RequestLog *	mPrevious;
+	};
+
+private:
+	struct Record
+	{
+		spdlog::level::level_enum		mLevel;
+		spdlog::log_clock::time_point	mTime;
+		spdlog::source_loc				mLocation;
+		size_t							mBegin;
+		size_t							mEnd;
+	};
+
+	static inline thread_local RequestLog *	tCurrent = nullptr;
+
+	spdlog::level::level_enum	mLevel = spdlog::level::debug;
+	size_t						mMaxBytes = 0;
+	uint64_t					mDropped = 0;
+	std::vector<Record>			mRecords;
+	fmt::memory_buffer			mText;
+};
+
+// Reuses the request buffers, and the memory they have grown, between requests
+class RequestLogPool
+{
+public:
+	explicit RequestLogPool( const TailLogConfig & config, size_t maxPooled = 64 )
+		: mConfig( config )
+		, mMaxPooled( maxPooled )
+	{
+	}
+
+	const TailLogConfig & config() const
+	{
+		return mConfig;
+	}
+
+	std::unique_ptr<RequestLog> acquire()
+	{
+		std::unique_ptr<RequestLog>	res;
+
+		{
+			std::lock_guard<std::mutex>	lock( mMutex );
+
+			if( !mFree.empty() ){
+				res = std::move( mFree.back() );
+				mFree.pop_back();
+			}
+		}
+		if( !res ){
+			res = std::make_unique<RequestLog>();
+		}
+		res->reset( mConfig.mLevel, mConfig.mMaxKB * 1024 );
+
+		return res;
+	}
+
+	void release( std::unique_ptr<RequestLog> requestLog )
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		if( mFree.size() < mMaxPooled ){
+			mFree.push_back( std::move( requestLog ));
+		}
+	}
+
+private:
+	const TailLogConfig							mConfig;
+	const size_t								mMaxPooled;
+	std::vector<std::unique_ptr<RequestLog>>	mFree;
+	std::mutex									mMutex;
+};
+
+}
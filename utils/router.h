@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace utils {
+
+// Values of the {name} segments of the route that matched, in the order of the pattern.
+// They point into the path of the request.
+class RouteParams
+{
+public:
+	static constexpr size_t	MaxParams = 8;
+
+	std::string_view operator[]( size_t index ) const
+	{
+		return index < mCount ? mValues[ index ] : std::string_view();
+	}
+
+	size_t size() const
+	{
+		return mCount;
+	}
+
+	void clear()
+	{
+		mCount = 0;
+	}
+
+	void truncate( size_t count )
+	{
+		mCount = std::min( mCount, count );
+	}
+
+	bool push( std::string_view value )
+	{
+		if( mCount == MaxParams ){
+			return false;
+		}
+		mValues[ mCount++ ] = value;
+		return true;
+	}
+
+private:
+	std::array<std::string_view, MaxParams>	mValues;
+	size_t									mCount = 0;
+};
+
+// True for a non empty parameter of letters, digits, '_' and '.', like a ticker symbol. {name} segments
+// take any text, check them before using them in other URIs.
+inline bool isWord( std::string_view value )
+{
+	return !value.empty() && std::all_of( value.begin(), value.end(), []( char c ){
+		return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) || c == '_' || c == '.';
+	});
+}
+
+// A route of a Server, declared in a constexpr table:
+//
+//     static constexpr utils::Route<MyHTTPServer> Routes[] = {
+//         { "/health", &MyHTTPServer::health },
+//         { "/value/{symbol}", &MyHTTPServer::readSymbol },
+//     };
+template<typename Server, typename Request>
+struct BasicRoute
+{
+	using Handler = void ( Server::* )( Request &, const RouteParams & );
+
+	std::string_view	mPattern;
+	Handler				mHandler;
+};
+
+// Matches paths to routes with a trie of path segments. Literal segments are compared as text and {name}
+// segments take any non empty segment; literals win. The trie is built once, matching allocates nothing.
+template<typename Request>
+class Router
+{
+public:
+	using Handler = std::function<void( Request &, const RouteParams & )>;
+
+	// Returns false if the pattern has more than RouteParams::MaxParams parameters
+	bool add( std::string_view pattern, Handler handler )
+	{
+		uint32_t	node = 0;
+		size_t		params = 0;
+
+		if( mNodes.empty() ){
+			mNodes.emplace_back();
+		}
+		for( auto segment = firstSegment( pattern ); segment.mValid; segment = nextSegment( pattern, segment )){
+			if( segment.mText.size() > 2 && segment.mText.front() == '{' && segment.mText.back() == '}' ){
+				if( ++params > RouteParams::MaxParams ){
+					return false;
+				}
+				if( mNodes[ node ].mParam == None ){
+					mNodes[ node ].mParam = newNode();
+				}
+				node = mNodes[ node ].mParam;
+			}else{
+				node = literalChild( node, segment.mText );
+			}
+		}
+		mNodes[ node ].mRoute = static_cast<uint32_t>( mHandlers.size() );
+		mHandlers.push_back( std::move( handler ));
+		return true;
+	}
+
+	// Handler of the route that matches the path, with its parameters, or nullptr
+	const Handler * match( std::string_view path, RouteParams & params ) const
+	{
+		params.clear();
+		if( mNodes.empty() ){
+			return nullptr;
+		}
+		const uint32_t node = match( 0, path, firstSegment( path ), params );
+
+		return node == None ? nullptr : &mHandlers[ mNodes[ node ].mRoute ];
+	}
+
+	bool dispatch( std::string_view path, Request & request ) const
+	{
+		RouteParams		params;
+		const Handler *	handler = match( path, params );
+
+		if( handler ){
+			( *handler )( request, params );
+		}
+		return handler != nullptr;
+	}
+
+private:
+	static constexpr uint32_t	None = UINT32_MAX;
+
+	struct Node
+	{
+		std::vector<std::pair<std::string, uint32_t>>	mLiterals;		// segment, node
+		uint32_t										mParam = None;
+		uint32_t										mRoute = None;
+	};
+
+	struct Segment
+	{
+		std::string_view	mText;
+		size_t				mEnd = 0;
+		bool				mValid = false;
+	};
+
+	std::vector<Node>		mNodes;
+	std::vector<Handler>	mHandlers;
+
+	// "/a/b/" has the segments a and b; "/" has none
+	static Segment firstSegment( std::string_view path )
+	{
+		return segmentAt( path, !path.empty() && path.front() == '/' ? 1 : 0 );
+	}
+
+	static Segment nextSegment( std::string_view path, const Segment & previous )
+	{
+		return segmentAt( path, previous.mEnd + 1 );
+	}
+
+	static Segment segmentAt( std::string_view path, size_t begin )
+	{
+		Segment res;
+
+		if( begin >= path.size() ){
+			return res;
+		}
+		const size_t end = std::min( path.find( '/', begin ), path.size() );
+
+		res.mText = path.substr( begin, end - begin );
+		res.mEnd = end;
+		res.mValid = true;
+		return res;
+	}
+
+	uint32_t newNode()
+	{
+		mNodes.emplace_back();
+		return static_cast<uint32_t>( mNodes.size() - 1 );
+	}
+
+	uint32_t literalChild( uint32_t node, std::string_view text )
+	{
+		for( const auto & [ literal, child ]: mNodes[ node ].mLiterals ){
+			if( literal == text ){
+				return child;
+			}
+		}
+		const uint32_t child = newNode();
+
+		mNodes[ node ].mLiterals.emplace_back( std::string( text ), child );
+		return child;
+	}
+
+	uint32_t match( uint32_t node, std::string_view path, const Segment & segment, RouteParams & params ) const
+	{
+		if( !segment.mValid ){
+			return mNodes[ node ].mRoute != None ? node : None;
+		}
+		const Node & current = mNodes[ node ];
+
+		for( const auto & [ literal, child ]: current.mLiterals ){
+			if( literal == segment.mText ){
+				const uint32_t res = match( child, path, nextSegment( path, segment ), params );
+
+				if( res != None ){
+					return res;
+				}
+				break;
+			}
+		}
+		if( current.mParam != None && !segment.mText.empty() ){
+			const size_t count = params.size();
+
+			params.push( segment.mText );
+
+			const uint32_t res = match( current.mParam, path, nextSegment( path, segment ), params );
+
+			if( res != None ){
+				return res;
+			}
+			params.truncate( count );
+		}
+		return None;
+	}
+};
+
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace utils {
+
+// How new traces are sampled. Requests that continue a trace follow the decision of the caller.
+enum class SamplerType {
+	Const,				// param 1 samples every trace, 0 none
+	Probabilistic,		// param is the probability of sampling a trace
+	RateLimiting,		// param is the max traces per second
+	Adaptive			// param is the traces per second of each route, see RouteSampler
+};
+
+// Lets cxxopts parse the sampler: const, probabilistic, ratelimiting or adaptive
+inline std::istream & operator>>( std::istream & in, SamplerType & type )
+{
+	std::string text;
+
+	in >> text;
+	if( text == "const" ){
+		type = SamplerType::Const;
+	}else if( text == "probabilistic" ){
+		type = SamplerType::Probabilistic;
+	}else if( text == "ratelimiting" ){
+		type = SamplerType::RateLimiting;
+	}else if( text == "adaptive" ){
+		type = SamplerType::Adaptive;
+	}else{
+		in.setstate( std::ios::failbit );
+	}
+	return in;
+}
+
+struct SamplingConfig
+{
+	SamplerType		mType = SamplerType::Const;
+	double			mParam = 1;
+	bool			mLogSpans = false;		// the tracer also logs every finished span
+};
+
+// Token bucket written as one "theoretical arrival time", see LogSite. Allows bursts of one second.
+class TraceRateLimiter
+{
+public:
+	explicit TraceRateLimiter( double perSecond )
+		: mIntervalNs( perSecond > 0 ? static_cast<int64_t>( 1e9 / perSecond ) : 0 )
+		, mBurstNs( perSecond > 1 ? 1000000000 - mIntervalNs : 0 )
+	{
+	}
+
+	bool allow()
+	{
+		if( mIntervalNs == 0 ){
+			return false;
+		}
+		const int64_t	now = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+		int64_t			tat = mTAT.load( std::memory_order_relaxed );
+
+		do{
+			if( tat - now > mBurstNs ){
+				return false;
+			}
+		}while( !mTAT.compare_exchange_weak( tat, std::max( tat, now ) + mIntervalNs, std::memory_order_relaxed ));
+
+		return true;
+	}
+
+private:
+	const int64_t			mIntervalNs;
+	const int64_t			mBurstNs;
+	std::atomic<int64_t>	mTAT{ 0 };
+};
+
+// Adaptive sampling of one route: a probability recomputed every second from the requests of the last one, so
+// that the route is traced about target times per second, and never below MinProbability. Quiet routes keep a
+// probability of 1. A trace per minute is guaranteed when the probability alone would not take any.
+class RouteSampler
+{
+public:
+	static constexpr double		MinProbability = 0.001;
+
+	explicit RouteSampler( double target )
+		: mTarget( target )
+	{
+	}
+
+	bool sample( std::minstd_rand & random )
+	{
+		const int64_t	now = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+		int64_t			windowStart = mWindowStart.load( std::memory_order_relaxed );
+
+		if( windowStart == 0 ){
+			mWindowStart.compare_exchange_strong( windowStart, now, std::memory_order_relaxed );
+		}else if( now - windowStart >= AdjustIntervalNs && mWindowStart.compare_exchange_strong( windowStart, now, std::memory_order_relaxed )){
+			adjust( now - windowStart );
+		}
+		mRequests.fetch_add( 1, std::memory_order_relaxed );
+		if( std::uniform_real_distribution<double>( 0, 1 )( random ) < mProbability.load( std::memory_order_relaxed )){
+			return true;
+		}
+		return mLowerBound.allow();
+	}
+
+	double probability() const
+	{
+		return mProbability.load( std::memory_order_relaxed );
+	}
+
+private:
+	static constexpr int64_t	AdjustIntervalNs = 1000000000;
+
+	const double				mTarget;
+	std::atomic<double>			mProbability{ 1 };
+	std::atomic<uint64_t>		mRequests{ 0 };
+	std::atomic<int64_t>		mWindowStart{ 0 };
+	TraceRateLimiter			mLowerBound{ 1.0 / 60 };
+
+	// Only the thread that starts the new window gets here
+	void adjust( int64_t elapsedNs )
+	{
+		const double	rate = mRequests.exchange( 0, std::memory_order_relaxed ) * 1e9 / elapsedNs;
+
+		mProbability.store( rate > 0 ? std::clamp( mTarget / rate, MinProbability, 1.0 ) : 1.0, std::memory_order_relaxed );
+	}
+};
+
+// Decides whether a new trace is sampled. Process wide, configured by HTTPServer.
+class TraceSampler
+{
+public:
+	static TraceSampler & instance()
+	{
+		static TraceSampler sampler;
+
+		return sampler;
+	}
+
+	void configure( const SamplingConfig & config )
+	{
+		std::unique_lock<std::shared_mutex>	lock( mMutex );
+
+		mConfig = config;
+		mLimiter = std::make_unique<TraceRateLimiter>( config.mParam );
+		mRoutes.clear();
+	}
+
+	const SamplingConfig & config() const
+	{
+		return mConfig;
+	}
+
+	// route is the operation name of the root span
+	bool sample( const std::string & route )
+	{
+		static thread_local std::minstd_rand	random( std::random_device{}() );
+
+		switch( mConfig.mType )
+		{
+			case SamplerType::Const :
+				return mConfig.mParam != 0;
+
+			case SamplerType::Probabilistic :
+				return std::uniform_real_distribution<double>( 0, 1 )( random ) < mConfig.mParam;
+
+			case SamplerType::RateLimiting :
+				return mLimiter->allow();
+
+			case SamplerType::Adaptive :
+				return routeSampler( route ).sample( random );
+		}
+		return false;
+	}
+
+private:
+	SamplingConfig												mConfig;
+	std::unique_ptr<TraceRateLimiter>							mLimiter = std::make_unique<TraceRateLimiter>( 1 );
+	std::unordered_map<std::string, std::unique_ptr<RouteSampler>>	mRoutes;
+	std::shared_mutex											mMutex;
+
+	RouteSampler & routeSampler( const std::string & route )
+	{
+		{
+			std::shared_lock<std::shared_mutex>	lock( mMutex );
+			const auto							iter = mRoutes.find( route );
+
+			if( iter != mRoutes.end() ){
+				return *iter->second;
+			}
+		}
+		std::unique_lock<std::shared_mutex>	lock( mMutex );
+		auto &								sampler = mRoutes[ route ];
+
+		if( !sampler ){
+			sampler = std::make_unique<RouteSampler>( mConfig.mParam );
+		}
+		return *sampler;
+	}
+};
+
+}
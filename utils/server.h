@@ -1,9 +1,20 @@
 #pragma once
 
+#ifndef _WIN32
+#include <pplx/threadpool.h>
+#endif
+
+#include "listeners.h"
 #include "otutils.h"
+#include "router.h"
+#include "shutdown.h"
+#include "worker_pool.h"
 
 namespace utils {
 
+template<typename Server>
+using Route = BasicRoute<Server, web::http::http_request>;
+
 class HTTPServer
 {
 public:
@@ -19,25 +30,137 @@ public:
 		mGroup = group;
 	}
 
-	virtual void get( web::http::http_request & request ) = 0;
+	void setSampling( const SamplingConfig & config )
+	{
+		TraceSampler::instance().configure( config );
+	}
+
+	void setTracing( const TracerConfig & config )
+	{
+		mTracing = config;
+	}
+
+	// Keeps the debug messages of each request and logs them only if it fails or is slow
+	void setTailLog( const TailLogConfig & config )
+	{
+		if( config.mEnabled ){
+			warnDebugCompiledOut( "--log-tail" );
+			mTailLogs = std::make_unique<RequestLogPool>( config );
+		}else{
+			mTailLogs.reset();
+		}
+	}
+
+	// Requests whose trace is sampled log from this level, off by default. The rest follow the logger level.
+	void setSampledLogLevel( spdlog::level::level_enum level )
+	{
+		if( level <= spdlog::level::debug ){
+			warnDebugCompiledOut( "--log-sampled-debug" );
+		}
+		mSampledLogLevel = level;
+	}
 
-	void run( const std::string & name, int port )
+	// Sizes the cpprest thread pool. Call it before anything uses cpprest, Consul included.
+	static void initThreads( const ThreadsConfig & config )
 	{
-		YAML::Node configYAML = YAML::Load( utils::defaultOpenTracingConfig );
-#ifdef _JAEGER_ENABLED		
-		auto config = jaegertracing::Config::parse( configYAML );
-		auto tracer = jaegertracing::Tracer::make( name, config, jaegertracing::logging::consoleLogger());
-		opentracing::Tracer::InitGlobal( std::static_pointer_cast<opentracing::Tracer>(tracer) );
+#ifndef _WIN32
+		if( config.mIOThreads > 0 ){
+			try{
+				crossplat::threadpool::initialize_with_threads( config.mIOThreads );
+			}catch( const std::exception & e ){
+				spdlog::warn( "cpprest threads not set: {}", e.what() );
+			}
+		}
 #endif
+	}
+
+	// Starts config.mListeners processes that serve the same port, see forkListeners, and returns in each one.
+	// Call it first thing. The log files of each listener but the first get its index appended.
+	static void startListeners( const ThreadsConfig & config, LoggerConfig & logConfig )
+	{
+		const size_t listener = forkListeners( config.mListeners );
+
+		if( listener > 0 ){
+			for( auto file: { &logConfig.mLogFile, &logConfig.mGraylog.mSpillFile } ){
+				if( !file->empty() ){
+					*file += fmt::format( ".{}", listener );
+				}
+			}
+		}
+	}
+
+	// Worker threads and CPU pinning, see ThreadsConfig
+	void setThreads( const ThreadsConfig & config )
+	{
+		mThreads = config;
+		mThreadStats.mIO.mThreads = config.mIOThreads;
+	}
+
+	// On shutdown, time the requests in flight have to finish
+	void setDrain( std::chrono::milliseconds drain )
+	{
+		mDrain = drain;
+	}
+
+	// Calls the handler of the route that matches the path of the request, see setRoutes, or replies 404
+	virtual void get( web::http::http_request & request )
+	{
+		const auto & path = request.request_uri().path();
+
+		LOG_DEBUG( mLogger, "{} {} from {}", utility::conversions::to_utf8string( request.method() ), utility::conversions::to_utf8string( request.request_uri().to_string() ),
+			utility::conversions::to_utf8string( request.remote_address() ));
+#ifdef _UTF16_STRINGS
+		const bool found = mRouter.dispatch( utility::conversions::to_utf8string( path ), request );
+#else
+		const bool found = mRouter.dispatch( path, request );
+#endif
+		if( !found ){
+			LOG_LIMITED( mLogger, spdlog::level::err, "Unknown route {}", utility::conversions::to_utf8string( request.request_uri().to_string() ));
+			request.reply( web::http::status_codes::NotFound, "{}", "application/json; charset=utf-8" );
+		}
+	}
+
+	// Serves until Shutdown is requested. Then calls deregister, so no new requests are sent here, answers 503
+	// to the ones that still arrive while those in flight finish, up to setDrain, and closes the listener, the
+	// tracer and the log, flushing them.
+	void run( const std::string & name, int port, const std::function<void()> & deregister = {} )
+	{
+		initTracer( name );
+		if( mThreads.mWorkerThreads > 0 ){
+			mWorkers = std::make_unique<WorkerPool>( mThreads.mWorkerThreads, mThreads.mPin, mThreadStats );
+		}
+
+		// Listeners on the same port share the acceptor of cpprest: the accepts of a process go through one
+		// socket. Several processes with SO_REUSEPORT, see startListeners, get one each.
 		const std::string serverAddress = fmt::format("http://{0}:{1}", "127.0.0.1", port );
 		auto listener = std::make_unique<web::http::experimental::listener::http_listener>( utility::conversions::to_string_t(serverAddress ));
 
-		mLogger->debug( "Listener created." );
+		LOG_DEBUG( mLogger, "Listener created." );
 
 		listener->support( web::http::methods::GET, [this]( web::http::http_request request ){
-			get( request );
+			static thread_local const bool	pinned = mThreads.mPin && pinThread();
+			ThreadStats::Busy				busy( mThreadStats.mIO );
+
+			( void )pinned;
+			// Served even when every worker is busy
+			if( request.request_uri().path() == U("/metrics") ){
+				serveMetrics( request );
+				return;
+			}
+			mInFlight++;
+			if( mDraining ){
+				request.reply( web::http::status_codes::ServiceUnavailable, "{}", "application/json; charset=utf-8" );
+				requestDone();
+			}else if( mWorkers ){
+				mWorkers->submit([ this, request ]() mutable {
+					handle( request );
+				});
+			}else{
+				handle( request );
+			}
 		});
 		try{
+			const ReusePort::Scope	reusePort( mThreads.mListeners > 1 );
 			const auto listenerTask = listener->open().then([ serverAddress, this ]()
 			{
 				mLogger->info( "REST server running at {}.", serverAddress );
@@ -49,30 +172,227 @@ public:
 		}catch( const std::exception & /*e*/ ){
 			mLogger->critical( "REST server exception." );
 		}
-		
-		auto previousSignal = std::signal( SIGINT, HTTPServer::signalHandler );
-
-		using namespace std::chrono_literals;
-
-		while( mSignalStatus == 0 ){
-			std::this_thread::sleep_for( 500ms );
+		Shutdown::instance().wait();
+		mLogger->info( "REST server stopping, signal {}.", Shutdown::instance().signal() );
+		if( deregister ){
+			deregister();
 		}
+		drain();
+		// Nothing is queued once the listener is closed; the workers answer what is
+		listener->close().wait();
+		mWorkers.reset();
 		mLogger->info( "REST server closed." );
 		opentracing::Tracer::Global()->Close();
-		std::signal( SIGINT, previousSignal );
+		mLogger->flush();
 	}
 
 protected:
+	// The routes of the server, from a constexpr table of the derived class. Paths are matched as they are
+	// received, percent-encoded, without the query.
+	template<typename Server, size_t Count>
+	void setRoutes( const Route<Server> ( & routes )[ Count ] )
+	{
+		Server * server = static_cast<Server *>( this );
+
+		for( const auto & route: routes ){
+			if( !mRouter.add( route.mPattern, [ server, handler = route.mHandler ]( web::http::http_request & request, const RouteParams & params ){
+				( server->*handler )( request, params );
+			})){
+				mLogger->critical( "Too many parameters in route {}", route.mPattern );
+			}
+		}
+	}
+
+	void health( web::http::http_request & request, const RouteParams & )
+	{
+		request.reply( web::http::status_codes::OK, "{}", "application/json; charset=utf-8" );
+	}
+
 	std::string							mGroup = "primary";
 	std::shared_ptr<spdlog::logger>		mLogger;
-	static std::sig_atomic_t 			mSignalStatus;
+	std::unique_ptr<RequestLogPool>		mTailLogs;
+	TracerConfig						mTracing;
+	Router<web::http::http_request>		mRouter;
+	spdlog::level::level_enum			mSampledLogLevel = spdlog::level::off;
+	ThreadsConfig						mThreads;
+	ThreadStats							mThreadStats;
+	std::unique_ptr<WorkerPool>			mWorkers;
+	std::chrono::milliseconds			mDrain{ 10000 };
+	std::atomic<size_t>					mInFlight{ 0 };		// requests taken and not answered yet, /metrics aside
+	std::atomic<bool>					mDraining{ false };
+	std::atomic<bool>					mDrainExpired{ false };
+	std::mutex							mDrainMutex;
+	std::condition_variable				mDrained;
 
-	static void signalHandler( int signal )
+	// The option only has debug messages to work with when LOG_DEBUG is compiled in
+	void warnDebugCompiledOut( std::string_view option ) const
 	{
-		mSignalStatus = signal;
+#if LOG_ACTIVE_LEVEL > SPDLOG_LEVEL_DEBUG
+		mLogger->warn( "{} has no debug messages: built without them, rebuild with -DLOG_ACTIVE_LEVEL=DEBUG", option );
+#else
+		( void )option;
+#endif
 	}
-};
 
-std::sig_atomic_t HTTPServer::mSignalStatus;
+	void initTracer( const std::string & name )
+	{
+		switch( mTracing.mType )
+		{
+			case TracerType::Native :
+			{
+				auto exporter = newSpanExporter( mTracing.mExport, name );
+
+				if( mTracing.mTail.mEnabled ){
+					exporter = std::make_unique<TailSampler>( std::move( exporter ), mTracing.mTail );
+				}
+				opentracing::Tracer::InitGlobal( std::make_shared<NativeTracer>( std::move( exporter ), mTracing.mSlots, TraceSampler::instance().config().mLogSpans,
+					mTracing.mPropagation, &REDMetrics::instance() ));
+			}
+			break;
+
+			case TracerType::Jaeger :
+			{
+#ifdef JAEGER_ENABLED
+				YAML::Node configYAML = YAML::Load( utils::openTracingConfig( TraceSampler::instance().config(), mTracing.mPropagation ));
+				auto config = jaegertracing::Config::parse( configYAML );
+				auto tracer = jaegertracing::Tracer::make( name, config, jaegertracing::logging::consoleLogger());
+				opentracing::Tracer::InitGlobal( std::static_pointer_cast<opentracing::Tracer>(tracer) );
+#else
+				mLogger->warn( "Built without jaeger-client-cpp, spans are not recorded. Use --tracer native" );
+#endif
+			}
+			break;
+
+			case TracerType::None :
+			break;
+		}
+	}
+
+	// Counts the request as answered when it goes out of scope
+	class RequestDone
+	{
+	public:
+		explicit RequestDone( HTTPServer & server ) : mServer( server ) {}
+
+		~RequestDone()
+		{
+			mServer.requestDone();
+		}
+
+		RequestDone( const RequestDone & ) = delete;
+		RequestDone & operator=( const RequestDone & ) = delete;
+
+	private:
+		HTTPServer &	mServer;
+	};
+
+	void requestDone()
+	{
+		if( --mInFlight == 0 && mDraining ){
+			std::lock_guard<std::mutex>	lock( mDrainMutex );
+
+			mDrained.notify_all();
+		}
+	}
+
+	void drain()
+	{
+		std::unique_lock<std::mutex>	lock( mDrainMutex );
+
+		mDraining = true;
+		if( !mDrained.wait_for( lock, mDrain, [ this ](){ return mInFlight == 0; } )){
+			mLogger->warn( "{} requests still in flight after {} ms, the queued ones are answered 503", mInFlight.load(), mDrain.count() );
+		}
+		mDrainExpired = true;
+	}
+
+	void handle( web::http::http_request & request )
+	{
+		// newSpan sets the trace and the log level of the request, cleared when the handler returns
+		LogContext::Scope		logContext;
+		RequestLogLevel::Scope	logLevel( mSampledLogLevel );
+		const RequestDone		done( *this );
+
+		// Queued for a worker past the drain deadline
+		if( mDrainExpired ){
+			request.reply( web::http::status_codes::ServiceUnavailable, "{}", "application/json; charset=utf-8" );
+			return;
+		}
+		if( !mWorkers ){
+			dispatch( request );
+			return;
+		}
+		// Out of cpprest, nobody would answer
+		try{
+			dispatch( request );
+		}catch( const std::exception & e ){
+			LOG_LIMITED( mLogger, spdlog::level::err, "Request {} failed: {}", utility::conversions::to_utf8string( request.request_uri().to_string() ), e.what() );
+			request.reply( web::http::status_codes::InternalError, "{}", "application/json; charset=utf-8" );
+		}
+	}
+
+	void dispatch( web::http::http_request & request )
+	{
+		if( mTailLogs ){
+			getWithTailLog( request );
+		}else{
+			get( request );
+		}
+	}
+
+	// Request, error counts and latency of each operation, from the spans of the native tracer, how busy
+	// the threads are and what the log sinks sent and lost
+	void serveMetrics( web::http::http_request & request )
+	{
+		request.reply( web::http::status_codes::OK, utility::conversions::to_string_t( REDMetrics::instance().prometheus() + mThreadStats.prometheus() + LogMetrics::instance().prometheus() ),
+			utility::conversions::to_string_t( "text/plain; version=0.0.4; charset=utf-8" ));
+	}
+
+	void getWithTailLog( web::http::http_request & request )
+	{
+		auto		requestLog = mTailLogs->acquire();
+		const auto	start = std::chrono::steady_clock::now();
+		bool		failed = true;
+
+		try{
+			RequestLog::Scope	scope( requestLog.get() );
+
+			get( request );
+			failed = false;
+		}catch( ... ){
+			tailLog( request, *requestLog, start, failed );
+			mTailLogs->release( std::move( requestLog ));
+			throw;
+		}
+		tailLog( request, *requestLog, start, failed );
+		mTailLogs->release( std::move( requestLog ));
+	}
+
+	void tailLog( const web::http::http_request & request, const RequestLog & requestLog, std::chrono::steady_clock::time_point start, bool failed )
+	{
+		static LogSite	logSite( __FILE__, __LINE__, spdlog::level::warn, "Request {} {} {} in {} ms. Its {} messages follow" );
+		const auto		elapsed = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - start ).count();
+		const auto		response = request.get_response();
+		std::string		status = "failed";
+
+		// Handlers reply before returning; a reply still pending is judged by its latency only
+		if( !failed && response.is_done() ){
+			const auto code = response.get().status_code();
+
+			failed = code < 200 || code >= 300;
+			status = fmt::format( "replied {}", code );
+		}else if( !failed ){
+			status = "replied later";
+		}
+		if(( failed || elapsed >= mTailLogs->config().mSlowMs ) && requestLog.size() + requestLog.dropped() > 0 && logSite.allow() ){
+			mLogger->warn( "Request {} {} {} in {} ms. Its {} messages follow", utility::conversions::to_utf8string( request.method() ),
+				utility::conversions::to_utf8string( request.request_uri().to_string() ), status, elapsed, requestLog.size() + requestLog.dropped() );
+			requestLog.flush( *mLogger );
+			if( requestLog.dropped() > 0 ){
+				mLogger->warn( "{} messages not kept, over the {} KB per request limit", requestLog.dropped(), mTailLogs->config().mMaxKB );
+			}
+		}
+	}
+};
 
 }
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+namespace utils {
+
+// SIGINT and SIGTERM, waited for without polling. block() must be called before any thread starts, so every
+// thread inherits the blocked signals and only the watcher thread, in sigwait, receives them. A second
+// signal exits at once, for shutdowns that hang.
+class Shutdown
+{
+public:
+	static Shutdown & instance()
+	{
+		static Shutdown shutdown;
+
+		return shutdown;
+	}
+
+	void block()
+	{
+#ifndef _WIN32
+		sigset_t	signals;
+
+		sigemptyset( &signals );
+		sigaddset( &signals, SIGINT );
+		sigaddset( &signals, SIGTERM );
+		if( pthread_sigmask( SIG_BLOCK, &signals, nullptr ) == 0 ){
+			mWatched = true;
+			// Waits for the signals while the process lives
+			std::thread( [ this, signals ](){
+				int	signal = 0;
+
+				while( sigwait( &signals, &signal ) == 0 ){
+					if( requested() ){
+						std::_Exit( 128 + signal );
+					}
+					request( signal );
+				}
+			}).detach();
+			return;
+		}
+#endif
+		std::signal( SIGINT, Shutdown::signalHandler );
+		std::signal( SIGTERM, Shutdown::signalHandler );
+	}
+
+	bool requested() const
+	{
+		return signal() != 0;
+	}
+
+	// The signal received, 0 if none
+	int signal() const
+	{
+		return mSignal != 0 ? mSignal.load() : static_cast<int>( mHandled );
+	}
+
+	void request( int signal = SIGTERM )
+	{
+		{
+			std::lock_guard<std::mutex>	lock( mMutex );
+
+			mSignal = signal;
+		}
+		mCondition.notify_all();
+	}
+
+	// Returns requested()
+	template<typename Rep, typename Period>
+	bool waitFor( std::chrono::duration<Rep, Period> timeout )
+	{
+		const auto						deadline = std::chrono::steady_clock::now() + timeout;
+		std::unique_lock<std::mutex>	lock( mMutex );
+
+		if( mWatched ){
+			return mCondition.wait_until( lock, deadline, [ this ](){ return requested(); });
+		}
+		// Signal handlers can not notify, the flag they set is checked now and then
+		while( !requested() && std::chrono::steady_clock::now() < deadline ){
+			mCondition.wait_until( lock, std::min( deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds( 100 )));
+		}
+		return requested();
+	}
+
+	void wait()
+	{
+		while( !waitFor( std::chrono::hours( 1 ))){
+		}
+	}
+
+private:
+	std::mutex						mMutex;
+	std::condition_variable			mCondition;
+	std::atomic<int>				mSignal{ 0 };
+	std::atomic<bool>				mWatched{ false };		// the watcher thread takes the signals
+	static volatile std::sig_atomic_t	mHandled;
+
+	Shutdown() = default;
+
+	static void signalHandler( int signal )
+	{
+		mHandled = signal;
+	}
+};
+
+inline volatile std::sig_atomic_t Shutdown::mHandled = 0;
+
+}
@@ -0,0 +1,747 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include "gelf_encoder.h"
+#include "gelf_transport.h"
+
+namespace utils {
+
+// Tag keys, and string values, the services use. Spans keep their index instead of a copy.
+namespace tags {
+
+inline constexpr std::string_view	Interned[] = {
+	"",
+	"http.method", "http.url", "http.status_code", "error", "span.kind", "sampling.priority", "component", "peer.service",
+	"event", "message", "symbol",
+	"GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS", "PATCH",
+	"server", "client",
+	"request sent", "headers received", "body parsed"
+};
+
+// Passing these, rather than an equal literal, finds the index without comparing the text
+inline constexpr const char *	HTTPMethod = Interned[1].data();
+inline constexpr const char *	HTTPURL = Interned[2].data();
+inline constexpr const char *	HTTPStatusCode = Interned[3].data();
+inline constexpr const char *	Error = Interned[4].data();
+inline constexpr const char *	SpanKind = Interned[5].data();
+inline constexpr const char *	PeerService = Interned[8].data();
+inline constexpr const char *	Event = Interned[9].data();
+inline constexpr const char *	Symbol = Interned[11].data();
+inline constexpr const char *	Client = Interned[20].data();
+inline constexpr const char *	RequestSent = Interned[21].data();
+inline constexpr const char *	HeadersReceived = Interned[22].data();
+inline constexpr const char *	BodyParsed = Interned[23].data();
+
+inline constexpr uint8_t	ErrorId = 4;
+inline constexpr uint8_t	HTTPStatusCodeId = 3;
+inline constexpr uint8_t	SpanKindId = 5;
+inline constexpr uint8_t	EventId = 9;
+
+// Index in Interned, 0 if it is not there
+inline uint8_t intern( std::string_view text )
+{
+	constexpr uint8_t Count = sizeof( Interned ) / sizeof( Interned[0] );
+
+	for( uint8_t i = 1; i < Count; i++ ){
+		if( text.data() == Interned[i].data() ){
+			return i;
+		}
+	}
+	for( uint8_t i = 1; i < Count; i++ ){
+		if( text == Interned[i] ){
+			return i;
+		}
+	}
+	return 0;
+}
+
+}
+
+struct SpanTag
+{
+	enum class Type : uint8_t { String, Double, Bool, Long };
+
+	uint8_t			mKeyId = 0;			// in tags::Interned, 0 when the key is in mKeyText
+	Type			mType = Type::String;
+	uint8_t			mStringId = 0;		// in tags::Interned, 0 when the value is in mStringText
+	std::string		mKeyText;
+	std::string		mStringText;
+	double			mDouble = 0;
+	bool			mBool = false;
+	int64_t			mLong = 0;
+
+	std::string_view key() const
+	{
+		return mKeyId != 0 ? tags::Interned[ mKeyId ] : std::string_view( mKeyText );
+	}
+
+	std::string_view string() const
+	{
+		return mStringId != 0 ? tags::Interned[ mStringId ] : std::string_view( mStringText );
+	}
+
+	void setKey( std::string_view key )
+	{
+		mKeyId = tags::intern( key );
+		if( mKeyId == 0 ){
+			mKeyText.assign( key.data(), key.size() );
+		}
+	}
+
+	void setString( std::string_view text )
+	{
+		mType = Type::String;
+		mStringId = tags::intern( text );
+		if( mStringId == 0 ){
+			mStringText.assign( text.data(), text.size() );
+		}
+	}
+};
+
+struct SpanLog
+{
+	int64_t					mTimeNs = 0;
+	std::vector<SpanTag>	mFields;
+};
+
+// A finished span as seen by the exporters. Lives in a preallocated slot of NativeTracer and is reused,
+// so strings and vectors keep their capacity from one span to the next.
+struct SpanData
+{
+	static constexpr size_t	MaxTags = 16;
+
+	uint64_t				mTraceIdHigh = 0;
+	uint64_t				mTraceIdLow = 0;
+	uint64_t				mSpanId = 0;
+	uint64_t				mParentId = 0;
+	std::string				mOperation;
+	int64_t					mStartNs = 0;		// since the epoch
+	int64_t					mDurationNs = 0;
+	SpanTag					mTags[ MaxTags ];
+	size_t					mTagCount = 0;
+	std::vector<SpanLog>	mLogs;
+	size_t					mLogCount = 0;
+	std::string				mService;			// empty for the spans of this process
+	bool					mLocalRoot = false;	// started without a parent in this process
+};
+
+class SpanExporter
+{
+public:
+	virtual ~SpanExporter() = default;
+
+	// Called from the exporter thread of the tracer with up to a batch of spans
+	virtual void exportSpans( const std::vector<const SpanData *> & spans ) = 0;
+
+protected:
+	// Calls f( service, spans ) for the spans of each service, an empty service is this process.
+	// Only a collector of other services' spans, like TailSampler, mixes several in a batch.
+	template<typename F>
+	void forEachService( const std::vector<const SpanData *> & spans, F f )
+	{
+		mServices.clear();
+		for( const auto span: spans ){
+			if( std::find( mServices.begin(), mServices.end(), span->mService ) == mServices.end() ){
+				mServices.push_back( span->mService );
+			}
+		}
+		if( mServices.size() == 1 ){
+			f( mServices.front(), spans );
+			return;
+		}
+		for( const auto & service: mServices ){
+			mServiceSpans.clear();
+			for( const auto span: spans ){
+				if( span->mService == service ){
+					mServiceSpans.push_back( span );
+				}
+			}
+			f( service, mServiceSpans );
+		}
+	}
+
+private:
+	std::vector<std::string_view>	mServices;
+	std::vector<const SpanData *>	mServiceSpans;
+};
+
+// One OTLP/JSON ExportTraceServiceRequest per line, as read by the OpenTelemetry collector otlpjsonfile receiver.
+// https://github.com/open-telemetry/opentelemetry-proto/blob/main/docs/specification.md#json-protobuf-encoding
+class OTLPFileExporter : public SpanExporter
+{
+public:
+	OTLPFileExporter( const std::string & path, const std::string & serviceName )
+		: mFile( path, std::ios::app )
+		, mServiceName( serviceName )
+	{
+		if( !mFile ){
+			spdlog::error( "Error opening the span file {}", path );
+		}
+	}
+
+	void exportSpans( const std::vector<const SpanData *> & spans ) override
+	{
+		mOut.clear();
+		forEachService( spans, [ this ]( std::string_view service, const std::vector<const SpanData *> & serviceSpans ){
+			mOut.append( std::string_view( R"({"resourceSpans":[{"resource":{"attributes":[{"key":"service.name","value":{"stringValue":")" ));
+			appendJSONEscaped( mOut, service.empty() ? std::string_view( mServiceName ) : service );
+			mOut.append( std::string_view( R"("}}]},"scopeSpans":[{"scope":{"name":"utils::NativeTracer"},"spans":[)" ));
+			for( size_t i = 0; i < serviceSpans.size(); i++ ){
+				if( i > 0 ){
+					mOut.push_back( ',' );
+				}
+				appendSpan( *serviceSpans[i] );
+			}
+			mOut.append( std::string_view( "]}]}]}\n" ));
+		});
+		mFile.write( mOut.data(), mOut.size() );
+		mFile.flush();
+	}
+
+private:
+	std::ofstream			mFile;
+	const std::string		mServiceName;
+	fmt::memory_buffer		mOut;
+
+	void appendSpan( const SpanData & span )
+	{
+		int		kind = 1;		// SPAN_KIND_INTERNAL
+		bool	error = false;
+
+		for( size_t i = 0; i < span.mTagCount; i++ ){
+			const auto & tag = span.mTags[i];
+
+			if( tag.mKeyId == tags::SpanKindId ){
+				const auto value = tag.string();
+
+				kind = value == "server" ? 2 : value == "client" ? 3 : value == "producer" ? 4 : value == "consumer" ? 5 : 1;
+			}else if( tag.mKeyId == tags::ErrorId && tag.mType == SpanTag::Type::Bool ){
+				error = tag.mBool;
+			}
+		}
+		fmt::format_to( std::back_inserter( mOut ), R"({{"traceId":"{:016x}{:016x}","spanId":"{:016x}",)", span.mTraceIdHigh, span.mTraceIdLow, span.mSpanId );
+		if( span.mParentId != 0 ){
+			fmt::format_to( std::back_inserter( mOut ), R"("parentSpanId":"{:016x}",)", span.mParentId );
+		}
+		mOut.append( std::string_view( R"("name":")" ));
+		appendJSONEscaped( mOut, span.mOperation );
+		fmt::format_to( std::back_inserter( mOut ), R"(","kind":{},"startTimeUnixNano":"{}","endTimeUnixNano":"{}","attributes":[)", kind, span.mStartNs, span.mStartNs + span.mDurationNs );
+		appendAttributes( span.mTags, span.mTagCount );
+		mOut.append( std::string_view( R"(],"events":[)" ));
+		for( size_t i = 0; i < span.mLogCount; i++ ){
+			const auto & log = span.mLogs[i];
+
+			// The event field, as in the OpenTracing conventions, names the event
+			std::string_view	name = "log";
+
+			for( const auto & field: log.mFields ){
+				if( field.mKeyId == tags::EventId && field.mType == SpanTag::Type::String ){
+					name = field.string();
+				}
+			}
+			fmt::format_to( std::back_inserter( mOut ), R"({}{{"timeUnixNano":"{}","name":")", i > 0 ? "," : "", log.mTimeNs );
+			appendJSONEscaped( mOut, name );
+			mOut.append( std::string_view( R"(","attributes":[)" ));
+			appendAttributes( log.mFields.data(), log.mFields.size() );
+			mOut.append( std::string_view( "]}" ));
+		}
+		fmt::format_to( std::back_inserter( mOut ), R"(],"status":{{"code":{}}}}})", error ? 2 : 0 );
+	}
+
+	void appendAttributes( const SpanTag * tags, size_t count )
+	{
+		for( size_t i = 0; i < count; i++ ){
+			const auto & tag = tags[i];
+
+			mOut.append( std::string_view( i > 0 ? R"(,{"key":")" : R"({"key":")" ));
+			appendJSONEscaped( mOut, tag.key() );
+			switch( tag.mType )
+			{
+				case SpanTag::Type::String :
+					mOut.append( std::string_view( R"(","value":{"stringValue":")" ));
+					appendJSONEscaped( mOut, tag.string() );
+					mOut.append( std::string_view( R"("}})" ));
+				break;
+
+				case SpanTag::Type::Double :
+					fmt::format_to( std::back_inserter( mOut ), R"(","value":{{"doubleValue":{}}}}})", tag.mDouble );
+				break;
+
+				case SpanTag::Type::Bool :
+					fmt::format_to( std::back_inserter( mOut ), R"(","value":{{"boolValue":{}}}}})", tag.mBool );
+				break;
+
+				case SpanTag::Type::Long :
+					fmt::format_to( std::back_inserter( mOut ), R"(","value":{{"intValue":"{}"}}}})", tag.mLong );
+				break;
+			}
+		}
+	}
+};
+
+// Jaeger agent, Thrift binary protocol on UDP (port 6832 by default), as jaeger-client-cpp does.
+// https://github.com/jaegertracing/jaeger-idl/blob/master/thrift/agent.thrift
+class JaegerUDPExporter : public SpanExporter
+{
+public:
+	static constexpr size_t	MaxPacketSize = 65000;
+
+	JaegerUDPExporter( const GelfEndpoint & endpoint, const std::string & serviceName )
+		: mSocket( mContext )
+		, mServiceName( serviceName )
+	{
+		boost::system::error_code	error;
+
+		boost::asio::ip::udp::resolver	resolver( mContext );
+		const auto						endpoints = resolver.resolve( boost::asio::ip::udp::v4(), endpoint.mHost, endpoint.mPort, error );
+
+		if( error || endpoints.empty() ){
+			spdlog::error( "Error resolving the Jaeger agent {}:{}: {}", endpoint.mHost, endpoint.mPort, error.message() );
+		}else{
+			mEndpoint = *endpoints.begin();
+			mSocket.open( boost::asio::ip::udp::v4(), error );
+		}
+	}
+
+	void exportSpans( const std::vector<const SpanData *> & spans ) override
+	{
+		if( !mSocket.is_open() ){
+			return;
+		}
+		forEachService( spans, [ this ]( std::string_view service, const std::vector<const SpanData *> & serviceSpans ){
+			exportService( service.empty() ? std::string_view( mServiceName ) : service, serviceSpans );
+		});
+	}
+
+	// Reads a packet written by exportSpans. next() returns the SpanData to fill for each span.
+	template<typename F>
+	static bool decode( const uint8_t * data, size_t size, F next )
+	{
+		Reader			reader{ data, data + size };
+		std::string		name;
+		std::string		service;
+
+		if(( static_cast<uint32_t>( reader.i32() ) & 0xffff0000 ) != 0x80010000 || !reader.string( name ) || name != "emitBatch" ){
+			return false;
+		}
+		reader.i32();							// seqid
+		return reader.structure( [ & ]( uint8_t type, int16_t id ){
+			if( id != 1 || type != Struct ){	// batch
+				return reader.skip( type );
+			}
+			return reader.structure( [ & ]( uint8_t type, int16_t id ){
+				if( id == 1 && type == Struct ){	// process
+					return reader.structure( [ & ]( uint8_t type, int16_t id ){
+						return id == 1 && type == String ? reader.string( service ) : reader.skip( type );
+					});
+				}else if( id == 2 && type == List ){
+					return reader.list( [ & ]( uint8_t type ){
+						if( type != Struct ){
+							return reader.skip( type );
+						}
+						SpanData & span = next();
+
+						span.mService = service;
+						return readSpan( reader, span );
+					});
+				}
+				return reader.skip( type );
+			});
+		});
+	}
+
+private:
+	enum ThriftType : uint8_t { Stop = 0, Bool = 2, Double = 4, I32 = 8, I64 = 10, String = 11, Struct = 12, List = 15 };
+	enum TagType : int32_t { TagString = 0, TagDouble = 1, TagBool = 2, TagLong = 3 };
+
+	static constexpr uint32_t	OneWay = 4;
+
+	// Thrift binary protocol, reads the few types Jaeger uses. Fails instead of reading past the end.
+	struct Reader
+	{
+		const uint8_t *	mPos;
+		const uint8_t *	mEnd;
+		bool			mOk = true;
+
+		bool has( size_t size )
+		{
+			mOk = mOk && static_cast<size_t>( mEnd - mPos ) >= size;
+			return mOk;
+		}
+
+		uint64_t bigEndian( size_t size )
+		{
+			uint64_t res = 0;
+
+			if( has( size )){
+				for( size_t i = 0; i < size; i++ ){
+					res = ( res << 8 ) | *mPos++;
+				}
+			}
+			return res;
+		}
+
+		uint8_t u8()		{ return static_cast<uint8_t>( bigEndian( 1 )); }
+		int16_t i16()		{ return static_cast<int16_t>( bigEndian( 2 )); }
+		int32_t i32()		{ return static_cast<int32_t>( bigEndian( 4 )); }
+		int64_t i64()		{ return static_cast<int64_t>( bigEndian( 8 )); }
+
+		bool string( std::string & text )
+		{
+			const int32_t size = i32();
+
+			if( size < 0 || !has( static_cast<size_t>( size ))){
+				return mOk = false;
+			}
+			text.assign( reinterpret_cast<const char *>( mPos ), static_cast<size_t>( size ));
+			mPos += size;
+			return true;
+		}
+
+		// f( type, id ) reads or skips each field
+		template<typename F>
+		bool structure( F f )
+		{
+			while( mOk ){
+				const uint8_t type = u8();
+
+				if( type == Stop || !mOk ){
+					break;
+				}
+				const int16_t id = i16();
+
+				if( !f( type, id )){
+					mOk = false;
+				}
+			}
+			return mOk;
+		}
+
+		// f( type ) reads or skips each element
+		template<typename F>
+		bool list( F f )
+		{
+			const uint8_t	type = u8();
+			const int32_t	size = i32();
+
+			for( int32_t i = 0; i < size && mOk; i++ ){
+				if( !f( type )){
+					mOk = false;
+				}
+			}
+			return mOk && size >= 0;
+		}
+
+		bool skip( uint8_t type )
+		{
+			std::string	text;
+
+			switch( type )
+			{
+				case Bool :		return has( 1 ) && ( ++mPos, true );
+				case Double :
+				case I64 :		return has( 8 ) && ( mPos += 8, true );
+				case I32 :		return has( 4 ) && ( mPos += 4, true );
+				case 6 :		return has( 2 ) && ( mPos += 2, true );		// i16
+				case String :	return string( text );
+				case Struct :	return structure( [ this ]( uint8_t type, int16_t ){ return skip( type ); });
+				case List :		return list( [ this ]( uint8_t type ){ return skip( type ); });
+				default :		return mOk = false;
+			}
+		}
+	};
+
+	static bool readTag( Reader & reader, SpanTag & tag )
+	{
+		return reader.structure( [ & ]( uint8_t type, int16_t id ){
+			switch( id )
+			{
+				case 1 :
+					if( type != String || !reader.string( tag.mKeyText )){
+						return false;
+					}
+					tag.mKeyId = tags::intern( tag.mKeyText );
+					return true;
+
+				case 2 :
+				{
+					const int32_t value = type == I32 ? reader.i32() : -1;
+
+					tag.mType = value == TagDouble ? SpanTag::Type::Double : value == TagBool ? SpanTag::Type::Bool : value == TagLong ? SpanTag::Type::Long : SpanTag::Type::String;
+					return type == I32;
+				}
+				case 3 :
+					if( type != String || !reader.string( tag.mStringText )){
+						return false;
+					}
+					tag.mStringId = tags::intern( tag.mStringText );
+					return true;
+
+				case 4 :
+				{
+					const uint64_t bits = static_cast<uint64_t>( reader.i64() );
+
+					std::memcpy( &tag.mDouble, &bits, sizeof( bits ));
+					return type == Double;
+				}
+				case 5 :	tag.mBool = reader.u8() != 0; return type == Bool;
+				case 6 :	tag.mLong = reader.i64(); return type == I64;
+				default :	return reader.skip( type );
+			}
+		});
+	}
+
+	static bool readSpan( Reader & reader, SpanData & span )
+	{
+		span.mTagCount = 0;
+		span.mLogCount = 0;
+		span.mLocalRoot = false;
+		return reader.structure( [ & ]( uint8_t type, int16_t id ){
+			switch( id )
+			{
+				case 1 :	span.mTraceIdLow = static_cast<uint64_t>( reader.i64() ); return type == I64;
+				case 2 :	span.mTraceIdHigh = static_cast<uint64_t>( reader.i64() ); return type == I64;
+				case 3 :	span.mSpanId = static_cast<uint64_t>( reader.i64() ); return type == I64;
+				case 4 :	span.mParentId = static_cast<uint64_t>( reader.i64() ); return type == I64;
+				case 5 :	return type == String && reader.string( span.mOperation );
+				case 8 :	span.mStartNs = reader.i64() * 1000; return type == I64;
+				case 9 :	span.mDurationNs = reader.i64() * 1000; return type == I64;
+				case 10 :
+					return type == List && reader.list( [ & ]( uint8_t type ){
+						if( span.mTagCount == SpanData::MaxTags ){
+							return reader.skip( type );
+						}
+						return type == Struct && readTag( reader, span.mTags[ span.mTagCount++ ] );
+					});
+				case 11 :
+					return type == List && reader.list( [ & ]( uint8_t type ){
+						if( type != Struct ){
+							return false;
+						}
+						if( span.mLogs.size() == span.mLogCount ){
+							span.mLogs.emplace_back();
+						}
+						SpanLog & log = span.mLogs[ span.mLogCount++ ];
+
+						log.mFields.clear();
+						return reader.structure( [ & ]( uint8_t type, int16_t id ){
+							if( id == 1 && type == I64 ){
+								log.mTimeNs = reader.i64() * 1000;
+								return true;
+							}else if( id == 2 && type == List ){
+								return reader.list( [ & ]( uint8_t type ){
+									return type == Struct && readTag( reader, log.mFields.emplace_back() );
+								});
+							}
+							return reader.skip( type );
+						});
+					});
+				default :	return reader.skip( type );
+			}
+		});
+	}
+
+	boost::asio::io_context				mContext;
+	boost::asio::ip::udp::socket		mSocket;
+	boost::asio::ip::udp::endpoint		mEndpoint;
+	const std::string					mServiceName;
+	std::vector<uint8_t>				mHeader;
+	std::vector<uint8_t>				mSpans;
+	std::vector<size_t>					mOffsets;
+	std::vector<uint8_t>				mPacket;
+
+	void exportService( std::string_view service, const std::vector<const SpanData *> & spans )
+	{
+		size_t	first = 0;
+
+		// emitBatch( Batch )
+		mHeader.clear();
+		putI32( mHeader, static_cast<int32_t>( 0x80010000 | OneWay ));
+		putString( mHeader, "emitBatch" );
+		putI32( mHeader, 0 );
+		putField( mHeader, Struct, 1 );			// batch
+		putField( mHeader, Struct, 1 );			// process
+		putField( mHeader, String, 1 );			// serviceName
+		putString( mHeader, service );
+		mHeader.push_back( Stop );
+
+		mSpans.clear();
+		mOffsets.clear();
+		for( const auto span: spans ){
+			mOffsets.push_back( mSpans.size() );
+			putSpan( mSpans, *span );
+		}
+		mOffsets.push_back( mSpans.size() );
+		// As many spans per datagram as fit
+		while( first < spans.size() ){
+			size_t last = first + 1;
+
+			while( last < spans.size() && mHeader.size() + 8 + mOffsets[ last + 1 ] - mOffsets[ first ] <= MaxPacketSize ){
+				last++;
+			}
+			send( first, last );
+			first = last;
+		}
+	}
+
+	void send( size_t first, size_t last )
+	{
+		boost::system::error_code	error;
+
+		mPacket.assign( mHeader.begin(), mHeader.end() );
+		putField( mPacket, List, 2 );			// spans
+		mPacket.push_back( Struct );
+		putI32( mPacket, static_cast<int32_t>( last - first ));
+		mPacket.insert( mPacket.end(), mSpans.begin() + mOffsets[ first ], mSpans.begin() + mOffsets[ last ] );
+		mPacket.push_back( Stop );				// end of Batch
+		mPacket.push_back( Stop );				// end of the arguments
+		mSocket.send_to( boost::asio::buffer( mPacket ), mEndpoint, 0, error );
+		if( error ){
+			spdlog::warn( "Error sending spans to the Jaeger agent: {}", error.message() );
+		}
+	}
+
+	static void putI32( std::vector<uint8_t> & out, int32_t value )
+	{
+		for( int shift = 24; shift >= 0; shift -= 8 ){
+			out.push_back( static_cast<uint8_t>( static_cast<uint32_t>( value ) >> shift ));
+		}
+	}
+
+	static void putI64( std::vector<uint8_t> & out, int64_t value )
+	{
+		for( int shift = 56; shift >= 0; shift -= 8 ){
+			out.push_back( static_cast<uint8_t>( static_cast<uint64_t>( value ) >> shift ));
+		}
+	}
+
+	static void putString( std::vector<uint8_t> & out, std::string_view text )
+	{
+		putI32( out, static_cast<int32_t>( text.size() ));
+		out.insert( out.end(), text.begin(), text.end() );
+	}
+
+	static void putField( std::vector<uint8_t> & out, ThriftType type, int16_t id )
+	{
+		out.push_back( type );
+		out.push_back( static_cast<uint8_t>( id >> 8 ));
+		out.push_back( static_cast<uint8_t>( id ));
+	}
+
+	static void putTags( std::vector<uint8_t> & out, const SpanTag * tags, size_t count )
+	{
+		out.push_back( Struct );
+		putI32( out, static_cast<int32_t>( count ));
+		for( size_t i = 0; i < count; i++ ){
+			const auto & tag = tags[i];
+
+			putField( out, String, 1 );
+			putString( out, tag.key() );
+			putField( out, I32, 2 );
+			switch( tag.mType )
+			{
+				case SpanTag::Type::String :
+					putI32( out, TagString );
+					putField( out, String, 3 );
+					putString( out, tag.string() );
+				break;
+
+				case SpanTag::Type::Double :
+				{
+					uint64_t bits;
+
+					std::memcpy( &bits, &tag.mDouble, sizeof( bits ));
+					putI32( out, TagDouble );
+					putField( out, Double, 4 );
+					putI64( out, static_cast<int64_t>( bits ));
+				}
+				break;
+
+				case SpanTag::Type::Bool :
+					putI32( out, TagBool );
+					putField( out, Bool, 5 );
+					out.push_back( tag.mBool ? 1 : 0 );
+				break;
+
+				case SpanTag::Type::Long :
+					putI32( out, TagLong );
+					putField( out, I64, 6 );
+					putI64( out, tag.mLong );
+				break;
+			}
+			out.push_back( Stop );
+		}
+	}
+
+	static void putSpan( std::vector<uint8_t> & out, const SpanData & span )
+	{
+		putField( out, I64, 1 );
+		putI64( out, static_cast<int64_t>( span.mTraceIdLow ));
+		putField( out, I64, 2 );
+		putI64( out, static_cast<int64_t>( span.mTraceIdHigh ));
+		putField( out, I64, 3 );
+		putI64( out, static_cast<int64_t>( span.mSpanId ));
+		putField( out, I64, 4 );
+		putI64( out, static_cast<int64_t>( span.mParentId ));
+		putField( out, String, 5 );
+		putString( out, span.mOperation );
+		putField( out, I32, 7 );
+		putI32( out, 1 );						// sampled
+		putField( out, I64, 8 );
+		putI64( out, span.mStartNs / 1000 );
+		putField( out, I64, 9 );
+		putI64( out, span.mDurationNs / 1000 );
+		if( span.mTagCount > 0 ){
+			putField( out, List, 10 );
+			putTags( out, span.mTags, span.mTagCount );
+		}
+		if( span.mLogCount > 0 ){
+			putField( out, List, 11 );
+			out.push_back( Struct );
+			putI32( out, static_cast<int32_t>( span.mLogCount ));
+			for( size_t i = 0; i < span.mLogCount; i++ ){
+				putField( out, I64, 1 );
+				putI64( out, span.mLogs[i].mTimeNs / 1000 );
+				putField( out, List, 2 );
+				putTags( out, span.mLogs[i].mFields.data(), span.mLogs[i].mFields.size() );
+				out.push_back( Stop );
+			}
+		}
+		out.push_back( Stop );
+	}
+};
+
+// file:///path/spans.json or udp://host:port (Jaeger agent). Returns nullptr, spans are discarded, for an empty url.
+inline std::unique_ptr<SpanExporter> newSpanExporter( const std::string & url, const std::string & serviceName )
+{
+	std::unique_ptr<SpanExporter>	res;
+
+	if( url.rfind( "file://", 0 ) == 0 ){
+		res = std::make_unique<OTLPFileExporter>( url.substr( 7 ), serviceName );
+	}else if( url.rfind( "udp://", 0 ) == 0 ){
+		auto endpoint = parseGelfEndpoint( url );
+
+		if( url.find( ':', 6 ) == std::string::npos ){
+			endpoint.mPort = "6832";
+		}
+		res = std::make_unique<JaegerUDPExporter>( endpoint, serviceName );
+	}else if( !url.empty() ){
+		spdlog::error( "Unknown span exporter {}, use file:// or udp://", url );
+	}
+	return res;
+}
+
+}
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace utils {
+
+// Told about every span the tracer finishes, sampled or not
+class SpanObserver
+{
+public:
+	virtual ~SpanObserver() = default;
+
+	// When the span starts. The tracer passes the result back to finished.
+	virtual uint32_t started( std::string_view operation ) = 0;
+
+	virtual void finished( uint32_t operation, int64_t durationNs, bool error ) = 0;
+};
+
+// Latency histogram in the manner of HdrHistogram: exact up to 127 us, then 64 linear buckets for each power
+// of two, so every value is kept within 1.6%. Written by one thread, read by any.
+class LatencyHistogram
+{
+public:
+	static constexpr size_t		SubBuckets = 64;
+	static constexpr size_t		Shifts = 32;				// values up to 2^38 us, about three days
+	static constexpr size_t		Count = 2 * SubBuckets + ( Shifts - 1 ) * SubBuckets;
+	static constexpr uint64_t	MaxUs = ( uint64_t( 2 * SubBuckets ) << ( Shifts - 1 )) - 1;
+
+	static size_t index( uint64_t us )
+	{
+		if( us < 2 * SubBuckets ){
+			return static_cast<size_t>( us );
+		}
+		if( us > MaxUs ){
+			us = MaxUs;
+		}
+		const size_t	shift = 63 - static_cast<size_t>( __builtin_clzll( us )) - 6;
+		const size_t	sub = static_cast<size_t>( us >> shift );
+
+		return 2 * SubBuckets + ( shift - 1 ) * SubBuckets + ( sub - SubBuckets );
+	}
+
+	// Largest value kept in the bucket
+	static uint64_t upperBound( size_t index )
+	{
+		if( index < 2 * SubBuckets ){
+			return index;
+		}
+		const size_t	shift = ( index - 2 * SubBuckets ) / SubBuckets + 1;
+		const uint64_t	sub = ( index - 2 * SubBuckets ) % SubBuckets + SubBuckets;
+
+		return (( sub + 1 ) << shift ) - 1;
+	}
+
+	void record( uint64_t us )
+	{
+		auto & count = mCounts[ index( us ) ];
+
+		count.store( count.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+	}
+
+	void addTo( std::vector<uint64_t> & counts ) const
+	{
+		counts.resize( Count );
+		for( size_t i = 0; i < Count; i++ ){
+			counts[i] += mCounts[i].load( std::memory_order_relaxed );
+		}
+	}
+
+private:
+	std::atomic<uint64_t>	mCounts[ Count ] = {};
+};
+
+// Appends the Prometheus histogram name{labels} of the counts of a LatencyHistogram, with the usual le buckets.
+// Returns the number of values, counted from the buckets as a scrape may race with the writers.
+inline uint64_t appendHistogram( std::string & out, std::string_view name, std::string_view labels, const std::vector<uint64_t> & counts, uint64_t sumUs )
+{
+	static constexpr double	Bounds[] = { 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+	const std::string_view	separator = labels.empty() ? "" : ",";
+	uint64_t				count = 0;
+	uint64_t				cumulative = 0;
+	size_t					bucket = 0;
+
+	for( const auto c: counts ){
+		count += c;
+	}
+	for( const auto bound: Bounds ){
+		const uint64_t boundUs = static_cast<uint64_t>( bound * 1e6 );
+
+		while( bucket < counts.size() && LatencyHistogram::upperBound( bucket ) <= boundUs ){
+			cumulative += counts[ bucket++ ];
+		}
+		fmt::format_to( std::back_inserter( out ), "{}_bucket{{{}{}le=\"{}\"}} {}\n", name, labels, separator, bound, cumulative );
+	}
+	fmt::format_to( std::back_inserter( out ), "{}_bucket{{{}{}le=\"+Inf\"}} {}\n", name, labels, separator, count );
+	if( labels.empty() ){
+		fmt::format_to( std::back_inserter( out ), "{}_sum {}\n{}_count {}\n", name, sumUs / 1e6, name, count );
+	}else{
+		fmt::format_to( std::back_inserter( out ), "{}_sum{{{}}} {}\n{}_count{{{}}} {}\n", name, labels, sumUs / 1e6, name, labels, count );
+	}
+	return count;
+}
+
+// RED metrics (rate, errors, duration) of each operation, from the spans the tracer finishes. Each thread
+// counts into its own shard without locks or shared cache lines; the shards are merged when scraped.
+// Shards of threads that exit are reused by new threads, so their counts are not lost.
+class REDMetrics : public SpanObserver
+{
+public:
+	static constexpr uint32_t	MaxOperations = 128;		// later ones are counted as "other"
+
+	static REDMetrics & instance()
+	{
+		static REDMetrics metrics;
+
+		return metrics;
+	}
+
+	uint32_t started( std::string_view operation ) override
+	{
+		// Few operations, each thread remembers the ones it saw
+		static thread_local std::vector<std::pair<std::string, uint32_t>>	known;
+
+		for( const auto & [ name, id ]: known ){
+			if( name == operation ){
+				return id;
+			}
+		}
+		const uint32_t id = operationId( operation );
+
+		known.emplace_back( std::string( operation ), id );
+		return id;
+	}
+
+	void finished( uint32_t operation, int64_t durationNs, bool error ) override
+	{
+		Operation &		counts = localShard().operation( operation );
+		const uint64_t	us = durationNs > 0 ? static_cast<uint64_t>( durationNs / 1000 ) : 0;
+
+		add( counts.mRequests, 1 );
+		if( error ){
+			add( counts.mErrors, 1 );
+		}
+		add( counts.mSumUs, us );
+		counts.mLatency.record( us );
+	}
+
+	// Prometheus text format, https://prometheus.io/docs/instrumenting/exposition_formats/
+	std::string prometheus() const
+	{
+		static constexpr double	Quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+		std::lock_guard<std::mutex>	lock( mMutex );
+		std::vector<Merged>			merged( mNames.size() );
+		std::string					requests;
+		std::string					errors;
+		std::string					duration;
+		std::string					latency;
+
+		for( const auto & shard: mShards ){
+			for( size_t i = 0; i < merged.size(); i++ ){
+				const Operation * counts = shard->mOperations[i].load( std::memory_order_acquire );
+
+				if( counts ){
+					merged[i].mRequests += counts->mRequests.load( std::memory_order_relaxed );
+					merged[i].mErrors += counts->mErrors.load( std::memory_order_relaxed );
+					merged[i].mSumUs += counts->mSumUs.load( std::memory_order_relaxed );
+					counts->mLatency.addTo( merged[i].mLatency );
+				}
+			}
+		}
+		for( size_t i = 0; i < merged.size(); i++ ){
+			const auto &		m = merged[i];
+			const std::string	label = escapeLabel( mNames[i] );
+
+			if( m.mLatency.empty() ){
+				continue;
+			}
+			const uint64_t count = appendHistogram( duration, "request_duration_seconds", fmt::format( "operation=\"{}\"", label ), m.mLatency, m.mSumUs );
+
+			fmt::format_to( std::back_inserter( requests ), "requests_total{{operation=\"{}\"}} {}\n", label, m.mRequests );
+			fmt::format_to( std::back_inserter( errors ), "request_errors_total{{operation=\"{}\"}} {}\n", label, m.mErrors );
+			for( const auto quantile: Quantiles ){
+				fmt::format_to( std::back_inserter( latency ), "request_latency_seconds{{operation=\"{}\",quantile=\"{}\"}} {}\n", label, quantile, valueAt( m.mLatency, count, quantile ) / 1e6 );
+			}
+		}
+		return "# HELP requests_total Finished spans.\n# TYPE requests_total counter\n" + requests
+			+ "# HELP request_errors_total Finished spans with the error tag.\n# TYPE request_errors_total counter\n" + errors
+			+ "# HELP request_duration_seconds Duration of the spans.\n# TYPE request_duration_seconds histogram\n" + duration
+			+ "# HELP request_latency_seconds Quantiles of the duration of the spans since the start.\n# TYPE request_latency_seconds gauge\n" + latency;
+	}
+
+private:
+	struct Operation
+	{
+		std::atomic<uint64_t>	mRequests{ 0 };
+		std::atomic<uint64_t>	mErrors{ 0 };
+		std::atomic<uint64_t>	mSumUs{ 0 };
+		LatencyHistogram		mLatency;
+	};
+
+	struct Shard
+	{
+		std::atomic<Operation *>	mOperations[ MaxOperations ] = {};		// created by the owner thread when first used
+		bool						mInUse = true;
+
+		~Shard()
+		{
+			for( auto & counts: mOperations ){
+				delete counts.load();
+			}
+		}
+
+		Operation & operation( uint32_t id )
+		{
+			Operation * res = mOperations[ id ].load( std::memory_order_relaxed );
+
+			if( !res ){
+				res = new Operation();
+				mOperations[ id ].store( res, std::memory_order_release );
+			}
+			return *res;
+		}
+	};
+
+	struct Merged
+	{
+		uint64_t				mRequests = 0;
+		uint64_t				mErrors = 0;
+		uint64_t				mSumUs = 0;
+		std::vector<uint64_t>	mLatency;
+	};
+
+	// Returns the shard of the thread when it exits
+	struct ShardOwner
+	{
+		Shard *	mShard = nullptr;
+
+		~ShardOwner()
+		{
+			if( mShard ){
+				REDMetrics::instance().release( mShard );
+			}
+		}
+	};
+
+	mutable std::mutex										mMutex;
+	std::vector<std::unique_ptr<Shard>>						mShards;
+	std::vector<std::string>								mNames;
+	std::unordered_map<std::string, uint32_t>				mIds;
+
+	uint32_t operationId( std::string_view operation )
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+		const std::string			name( operation );
+		const auto					iter = mIds.find( name );
+
+		if( iter != mIds.end() ){
+			return iter->second;
+		}
+		if( mNames.size() == MaxOperations - 1 ){
+			mNames.emplace_back( "other" );
+		}
+		if( mNames.size() == MaxOperations ){
+			return MaxOperations - 1;
+		}
+		mNames.push_back( name );
+		mIds.emplace( name, uint32_t( mNames.size() - 1 ));
+		return uint32_t( mNames.size() - 1 );
+	}
+
+	Shard & localShard()
+	{
+		static thread_local ShardOwner	owner;
+
+		if( !owner.mShard ){
+			std::lock_guard<std::mutex>	lock( mMutex );
+
+			for( auto & shard: mShards ){
+				if( !shard->mInUse ){
+					shard->mInUse = true;
+					owner.mShard = shard.get();
+					break;
+				}
+			}
+			if( !owner.mShard ){
+				mShards.push_back( std::make_unique<Shard>() );
+				owner.mShard = mShards.back().get();
+			}
+		}
+		return *owner.mShard;
+	}
+
+	void release( Shard * shard )
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		shard->mInUse = false;
+	}
+
+	static void add( std::atomic<uint64_t> & counter, uint64_t value )
+	{
+		counter.store( counter.load( std::memory_order_relaxed ) + value, std::memory_order_relaxed );
+	}
+
+	static uint64_t valueAt( const std::vector<uint64_t> & counts, uint64_t total, double quantile )
+	{
+		const uint64_t	rank = static_cast<uint64_t>( quantile * double( total ) + 0.5 );
+		uint64_t		seen = 0;
+
+		for( size_t i = 0; i < counts.size(); i++ ){
+			seen += counts[i];
+			if( seen >= rank && seen > 0 ){
+				return LatencyHistogram::upperBound( i );
+			}
+		}
+		return 0;
+	}
+
+	static std::string escapeLabel( const std::string & text )
+	{
+		std::string res;
+
+		res.reserve( text.size() );
+		for( const char c: text ){
+			if( c == '\\' || c == '"' ){
+				res += '\\';
+				res += c;
+			}else if( c == '\n' ){
+				res += "\\n";
+			}else{
+				res += c;
+			}
+		}
+		return res;
+	}
+};
+
+}
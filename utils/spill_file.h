@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <spdlog/spdlog.h>
+
+namespace utils {
+
+// Bounded, append-only, memory-mapped FIFO of log messages.
+// Records are appended at the write offset and consumed from the read offset, both stored in the file
+// header so pending records survive a restart. Space is reclaimed when the file is drained, or by
+// moving the pending records to the start of the file when an append does not fit.
+class SpillFile
+{
+public:
+	SpillFile( const std::string & path, size_t maxBytes )
+		: mPath( path )
+	{
+		const size_t	fileSize = std::max<size_t>( maxBytes, sizeof( Header ) + 4096 );
+		bool			valid = false;
+		std::error_code	error;
+
+		if( std::filesystem::exists( mPath, error ) && std::filesystem::file_size( mPath, error ) >= sizeof( Header )){
+			Header			header{};
+			std::ifstream	in( mPath, std::ios::binary );
+
+			in.read( reinterpret_cast<char *>( &header ), sizeof( header ));
+			valid = in && std::memcmp( header.mMagic, Magic, sizeof( header.mMagic )) == 0 && header.mRead <= header.mWrite;
+			// Never shrink below the records still waiting to be replayed
+			if( valid && header.mWrite > fileSize ){
+				spdlog::warn( "Spill file {} has {} pending bytes, keeping its size over the configured limit.", mPath, header.mWrite - header.mRead );
+			}else{
+				std::filesystem::resize_file( mPath, fileSize );
+			}
+		}else{
+			std::ofstream( mPath, std::ios::binary | std::ios::trunc );
+			std::filesystem::resize_file( mPath, fileSize );
+		}
+		mFile = boost::interprocess::file_mapping( mPath.c_str(), boost::interprocess::read_write );
+		mRegion = boost::interprocess::mapped_region( mFile, boost::interprocess::read_write );
+		mHeader = static_cast<Header *>( mRegion.get_address() );
+		mCapacity = mRegion.get_size();
+		if( !valid ){
+			std::memcpy( mHeader->mMagic, Magic, sizeof( mHeader->mMagic ));
+			mHeader->mRead = sizeof( Header );
+			mHeader->mWrite = sizeof( Header );
+		}else if( mHeader->mRead < mHeader->mWrite ){
+			spdlog::info( "Spill file {} has {} bytes pending to be replayed.", mPath, mHeader->mWrite - mHeader->mRead );
+		}
+	}
+
+	~SpillFile()
+	{
+		mRegion.flush( 0, 0, true );
+	}
+
+	// Returns false, and counts the message as dropped, if the file is full
+	bool append( std::string_view message, spdlog::level::level_enum level )
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+		const size_t				recordSize = RecordHeaderSize + message.size();
+
+		if( mHeader->mWrite + recordSize > mCapacity ){
+			compact();
+			if( mHeader->mWrite + recordSize > mCapacity ){
+				mDropped++;
+				return false;
+			}
+		}
+		char *			record = base() + mHeader->mWrite;
+		const uint32_t	size = static_cast<uint32_t>( message.size() );
+
+		std::memcpy( record, &size, sizeof( size ));
+		record[ sizeof( size ) ] = static_cast<char>( level );
+		std::memcpy( record + RecordHeaderSize, message.data(), message.size() );
+		// The offset is published after the record so a crash never exposes a partial record
+		mHeader->mWrite += recordSize;
+
+		return true;
+	}
+
+	// Copies the oldest record into message. Returns false if the file is empty.
+	bool front( std::string & message, spdlog::level::level_enum & level ) const
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		if( mHeader->mRead >= mHeader->mWrite ){
+			return false;
+		}
+		const char *	record = base() + mHeader->mRead;
+		uint32_t		size = 0;
+
+		std::memcpy( &size, record, sizeof( size ));
+		level = static_cast<spdlog::level::level_enum>( record[ sizeof( size ) ] );
+		message.assign( record + RecordHeaderSize, size );
+
+		return true;
+	}
+
+	// Discards the oldest record
+	void pop()
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		if( mHeader->mRead < mHeader->mWrite ){
+			uint32_t	size = 0;
+
+			std::memcpy( &size, base() + mHeader->mRead, sizeof( size ));
+			mHeader->mRead += RecordHeaderSize + size;
+			if( mHeader->mRead >= mHeader->mWrite ){
+				mHeader->mRead = sizeof( Header );
+				mHeader->mWrite = sizeof( Header );
+			}
+		}
+	}
+
+	bool empty() const
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		return mHeader->mRead >= mHeader->mWrite;
+	}
+
+	size_t pendingBytes() const
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		return mHeader->mWrite - mHeader->mRead;
+	}
+
+	uint64_t dropped() const
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		return mDropped;
+	}
+
+private:
+	static constexpr char	Magic[8] = { 'G', 'E', 'L', 'F', 'S', 'P', 'L', '1' };
+	static constexpr size_t	RecordHeaderSize = sizeof( uint32_t ) + 1;
+
+	struct Header
+	{
+		char		mMagic[8];
+		uint64_t	mRead;
+		uint64_t	mWrite;
+	};
+
+	std::string								mPath;
+	boost::interprocess::file_mapping		mFile;
+	boost::interprocess::mapped_region		mRegion;
+	Header *								mHeader = nullptr;
+	size_t									mCapacity = 0;
+	uint64_t								mDropped = 0;
+	mutable std::mutex						mMutex;
+
+	char * base() const
+	{
+		return reinterpret_cast<char *>( mHeader );
+	}
+
+	void compact()
+	{
+		if( mHeader->mRead > sizeof( Header )){
+			const size_t pending = mHeader->mWrite - mHeader->mRead;
+
+			std::memmove( base() + sizeof( Header ), base() + mHeader->mRead, pending );
+			mHeader->mRead = sizeof( Header );
+			mHeader->mWrite = sizeof( Header ) + pending;
+		}
+	}
+};
+
+}
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include "gelf_transport.h"
+#include "span_exporter.h"
+
+namespace utils {
+
+struct TailSamplingConfig
+{
+	bool			mEnabled = false;
+	int				mSlowMs = 1000;			// traces whose root span is slower are kept
+	int				mMinStatus = 500;		// traces with a span with this http.status_code or higher are kept
+	double			mBaseline = 0.01;		// probability of keeping any other trace
+	size_t			mMaxMB = 64;			// spans buffered waiting for a decision, oldest traces are dropped beyond it
+	int				mWaitMs = 1000;			// wait for the spans of other services after the root span finishes
+	std::string		mListen;				// udp://host:port where other services send their spans, as to a Jaeger agent
+};
+
+struct TailSamplingStats
+{
+	uint64_t	mKept = 0;			// traces
+	uint64_t	mDropped = 0;		// traces
+	uint64_t	mEvicted = 0;		// traces dropped, undecided, to stay under mMaxMB
+	size_t		mBufferedBytes = 0;
+};
+
+// Tail-based sampling: keeps the spans of each trace, including the ones other services send to mListen,
+// until its local root span (the request this service received) finishes. Then keeps the whole trace if
+// it was slow or failed, or by chance, and hands it to the next exporter; otherwise drops it.
+// Spans that arrive after the decision follow it.
+class TailSampler : public SpanExporter
+{
+public:
+	TailSampler( std::unique_ptr<SpanExporter> next, const TailSamplingConfig & config )
+		: mNext( std::move( next ))
+		, mConfig( config )
+		, mSocket( mContext )
+	{
+		if( !mConfig.mListen.empty() ){
+			listen();
+		}
+		mThread = std::thread( &TailSampler::realRun, this );
+	}
+
+	~TailSampler() override
+	{
+		mRunThread = false;
+		mThread.join();
+		// What is still undecided is judged as is
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		for( auto & [ id, trace ]: mTraces ){
+			if( !trace.mDecided ){
+				decide( trace );
+			}
+		}
+		flushKept();
+	}
+
+	// From the exporter thread of the tracer: the spans of this service
+	void exportSpans( const std::vector<const SpanData *> & spans ) override
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+
+		for( const auto span: spans ){
+			auto data = newSpanData();
+
+			*data = *span;
+			add( std::move( data ));
+		}
+		flushKept();
+	}
+
+	TailSamplingStats stats() const
+	{
+		std::lock_guard<std::mutex>	lock( mMutex );
+		TailSamplingStats			res = mStats;
+
+		res.mBufferedBytes = mBufferedBytes;
+		return res;
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct TraceId
+	{
+		uint64_t	mHigh;
+		uint64_t	mLow;
+
+		bool operator==( const TraceId & other ) const
+		{
+			return mHigh == other.mHigh && mLow == other.mLow;
+		}
+	};
+
+	struct TraceIdHash
+	{
+		size_t operator()( const TraceId & id ) const
+		{
+			return std::hash<uint64_t>()( id.mLow ^ ( id.mHigh * 0x9e3779b97f4a7c15ULL ));
+		}
+	};
+
+	struct Trace
+	{
+		std::vector<std::unique_ptr<SpanData>>	mSpans;
+		size_t									mBytes = 0;
+		Clock::time_point						mFirstSeen;
+		Clock::time_point						mRootFinished;		// epoch while the root span is running
+		bool									mSlow = false;
+		bool									mFailed = false;
+		bool									mDecided = false;
+		bool									mKeep = false;
+	};
+
+	std::unique_ptr<SpanExporter>								mNext;
+	const TailSamplingConfig									mConfig;
+	std::unordered_map<TraceId, Trace, TraceIdHash>				mTraces;
+	std::vector<std::unique_ptr<SpanData>>						mFree;
+	std::vector<std::unique_ptr<SpanData>>						mKept;		// waiting to be exported
+	std::vector<const SpanData *>								mBatch;
+	size_t														mBufferedBytes = 0;
+	TailSamplingStats											mStats;
+	std::minstd_rand											mRandom{ std::random_device{}() };
+	mutable std::mutex											mMutex;
+	boost::asio::io_context										mContext;
+	boost::asio::ip::udp::socket								mSocket;
+	boost::asio::ip::udp::endpoint								mSender;
+	std::vector<uint8_t>										mPacket = std::vector<uint8_t>( 65536 );
+	std::thread													mThread;
+	std::atomic<bool>											mRunThread{ true };
+
+	static constexpr size_t	MaxFree = 4096;
+
+	static size_t bytes( const SpanData & span )
+	{
+		size_t res = sizeof( SpanData ) + span.mOperation.size() + span.mService.size();
+
+		for( size_t i = 0; i < span.mTagCount; i++ ){
+			res += span.mTags[i].mKeyText.size() + span.mTags[i].mStringText.size();
+		}
+		for( size_t i = 0; i < span.mLogCount; i++ ){
+			res += sizeof( SpanLog ) + span.mLogs[i].mFields.size() * sizeof( SpanTag );
+		}
+		return res;
+	}
+
+	std::unique_ptr<SpanData> newSpanData()
+	{
+		if( mFree.empty() ){
+			return std::make_unique<SpanData>();
+		}
+		auto res = std::move( mFree.back() );
+
+		mFree.pop_back();
+		return res;
+	}
+
+	void recycle( std::unique_ptr<SpanData> span )
+	{
+		if( mFree.size() < MaxFree ){
+			mFree.push_back( std::move( span ));
+		}
+	}
+
+	void add( std::unique_ptr<SpanData> span )
+	{
+		const auto	now = Clock::now();
+		auto		inserted = mTraces.try_emplace( TraceId{ span->mTraceIdHigh, span->mTraceIdLow } );
+		Trace &		trace = inserted.first->second;
+
+		if( inserted.second ){
+			trace.mFirstSeen = now;
+		}
+		for( size_t i = 0; i < span->mTagCount; i++ ){
+			const auto & tag = span->mTags[i];
+
+			if( tag.mKeyId == tags::ErrorId && tag.mType == SpanTag::Type::Bool && tag.mBool ){
+				trace.mFailed = true;
+			}else if( tag.mKeyId == tags::HTTPStatusCodeId && tag.mType == SpanTag::Type::Long && tag.mLong >= mConfig.mMinStatus ){
+				trace.mFailed = true;
+			}
+		}
+		if( span->mLocalRoot ){
+			trace.mRootFinished = now;
+			trace.mSlow = span->mDurationNs >= int64_t( mConfig.mSlowMs ) * 1000000;
+		}
+		if( trace.mDecided ){
+			if( trace.mKeep ){
+				mKept.push_back( std::move( span ));
+			}else{
+				recycle( std::move( span ));
+			}
+			return;
+		}
+		const size_t size = bytes( *span );
+
+		trace.mBytes += size;
+		mBufferedBytes += size;
+		trace.mSpans.push_back( std::move( span ));
+		while( mBufferedBytes > mConfig.mMaxMB * 1024 * 1024 && evictOldest() ){
+		}
+	}
+
+	void decide( Trace & trace )
+	{
+		trace.mDecided = true;
+		trace.mKeep = trace.mSlow || trace.mFailed || std::uniform_real_distribution<double>( 0, 1 )( mRandom ) < mConfig.mBaseline;
+		if( trace.mKeep ){
+			mStats.mKept++;
+		}else{
+			mStats.mDropped++;
+		}
+		for( auto & span: trace.mSpans ){
+			if( trace.mKeep ){
+				mKept.push_back( std::move( span ));
+			}else{
+				recycle( std::move( span ));
+			}
+		}
+		mBufferedBytes -= trace.mBytes;
+		trace.mBytes = 0;
+		trace.mSpans.clear();
+	}
+
+	bool evictOldest()
+	{
+		auto oldest = mTraces.end();
+
+		for( auto iter = mTraces.begin(); iter != mTraces.end(); ++iter ){
+			if( !iter->second.mSpans.empty() && ( oldest == mTraces.end() || iter->second.mFirstSeen < oldest->second.mFirstSeen )){
+				oldest = iter;
+			}
+		}
+		if( oldest == mTraces.end() ){
+			return false;
+		}
+		for( auto & span: oldest->second.mSpans ){
+			recycle( std::move( span ));
+		}
+		mBufferedBytes -= oldest->second.mBytes;
+		mStats.mEvicted++;
+		mTraces.erase( oldest );
+		return true;
+	}
+
+	// Decides the traces whose root finished mWaitMs ago, or that never saw it. Forgets decisions
+	// once late spans are no longer expected.
+	void expire()
+	{
+		const auto	now = Clock::now();
+		const auto	wait = std::chrono::milliseconds( mConfig.mWaitMs );
+
+		for( auto iter = mTraces.begin(); iter != mTraces.end(); ){
+			Trace &	trace = iter->second;
+			const bool rootFinished = trace.mRootFinished != Clock::time_point();
+
+			if( !trace.mDecided && (( rootFinished && now - trace.mRootFinished >= wait ) || now - trace.mFirstSeen >= 30 * wait )){
+				decide( trace );
+			}
+			if( trace.mDecided && now - ( rootFinished ? trace.mRootFinished : trace.mFirstSeen ) >= 4 * wait ){
+				iter = mTraces.erase( iter );
+			}else{
+				++iter;
+			}
+		}
+		flushKept();
+	}
+
+	void flushKept()
+	{
+		if( mKept.empty() ){
+			return;
+		}
+		mBatch.clear();
+		for( const auto & span: mKept ){
+			mBatch.push_back( span.get() );
+		}
+		if( mNext ){
+			mNext->exportSpans( mBatch );
+		}
+		for( auto & span: mKept ){
+			recycle( std::move( span ));
+		}
+		mKept.clear();
+	}
+
+	void listen()
+	{
+		const auto					endpoint = parseGelfEndpoint( mConfig.mListen );
+		boost::system::error_code	error;
+
+		boost::asio::ip::udp::resolver	resolver( mContext );
+		const auto						endpoints = resolver.resolve( boost::asio::ip::udp::v4(), endpoint.mHost, endpoint.mPort, error );
+
+		if( error || endpoints.empty() ){
+			spdlog::error( "Error resolving {}: {}", mConfig.mListen, error.message() );
+			return;
+		}
+		mSocket.open( boost::asio::ip::udp::v4(), error );
+		if( !error ){
+			mSocket.bind( *endpoints.begin(), error );
+		}
+		if( error ){
+			spdlog::error( "Error listening for spans in {}: {}", mConfig.mListen, error.message() );
+			mSocket.close( error );
+			return;
+		}
+		receive();
+	}
+
+	void receive()
+	{
+		mSocket.async_receive_from( boost::asio::buffer( mPacket ), mSender, [ this ]( const boost::system::error_code & error, size_t size ){
+			if( error ){
+				return;
+			}
+			std::vector<std::unique_ptr<SpanData>>	spans;
+			bool									ok;
+
+			{
+				std::lock_guard<std::mutex>	lock( mMutex );
+
+				ok = JaegerUDPExporter::decode( mPacket.data(), size, [ & ]() -> SpanData & {
+					spans.push_back( newSpanData() );
+					return *spans.back();
+				});
+				if( ok ){
+					for( auto & span: spans ){
+						add( std::move( span ));
+					}
+				}else{
+					for( auto & span: spans ){
+						recycle( std::move( span ));
+					}
+				}
+				flushKept();
+			}
+			if( !ok ){
+				spdlog::warn( "Invalid span batch from {}", mSender.address().to_string() );
+			}
+			receive();
+		});
+	}
+
+	void realRun()
+	{
+		while( mRunThread ){
+			if( mSocket.is_open() ){
+				mContext.run_for( std::chrono::milliseconds( 100 ));
+				if( mContext.stopped() ){
+					mContext.restart();
+				}
+			}else{
+				std::this_thread::sleep_for( std::chrono::milliseconds( 100 ));
+			}
+			std::lock_guard<std::mutex>	lock( mMutex );
+
+			expire();
+		}
+		boost::system::error_code	error;
+
+		mSocket.close( error );
+		mContext.run_for( std::chrono::milliseconds( 10 ));
+	}
+};
+
+}
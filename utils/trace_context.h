@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <string_view>
+
+namespace utils {
+
+// How the context of a trace is sent to the services we call
+enum class PropagationFormat {
+	W3C,		// traceparent and tracestate, https://www.w3.org/TR/trace-context/
+	Jaeger		// uber-trace-id and uberctx-{key}
+};
+
+// Lets cxxopts parse the propagation format: w3c or jaeger
+inline std::istream & operator>>( std::istream & in, PropagationFormat & format )
+{
+	std::string text;
+
+	in >> text;
+	if( text == "w3c" ){
+		format = PropagationFormat::W3C;
+	}else if( text == "jaeger" ){
+		format = PropagationFormat::Jaeger;
+	}else{
+		in.setstate( std::ios::failbit );
+	}
+	return in;
+}
+
+// W3C traceparent header: {version}-{trace-id}-{parent-id}-{flags}, 00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01
+// Every field has a fixed width, so it is parsed and written in place.
+struct TraceParent
+{
+	static constexpr size_t				Size = 55;
+	static constexpr std::string_view	Header = "traceparent";
+	static constexpr std::string_view	StateHeader = "tracestate";
+
+	uint64_t	mTraceIdHigh = 0;
+	uint64_t	mTraceIdLow = 0;
+	uint64_t	mParentId = 0;
+	uint8_t		mFlags = 0;
+
+	bool sampled() const
+	{
+		return ( mFlags & 1 ) != 0;
+	}
+
+	bool parse( std::string_view text )
+	{
+		uint64_t version = 0;
+		uint64_t flags = 0;
+
+		if( text.size() < Size || text[2] != '-' || text[35] != '-' || text[52] != '-' ){
+			return false;
+		}
+		if( !parseHex( text.data(), 2, version ) || version == 0xff || ( version == 0 && text.size() != Size )){
+			return false;
+		}
+		// Later versions may append fields
+		if( text.size() > Size && text[ Size ] != '-' ){
+			return false;
+		}
+		if( !parseHex( text.data() + 3, 16, mTraceIdHigh ) || !parseHex( text.data() + 19, 16, mTraceIdLow )
+			|| !parseHex( text.data() + 36, 16, mParentId ) || !parseHex( text.data() + 53, 2, flags )){
+			return false;
+		}
+		mFlags = static_cast<uint8_t>( flags );
+		return ( mTraceIdHigh != 0 || mTraceIdLow != 0 ) && mParentId != 0;
+	}
+
+	// Writes exactly Size characters, no terminating zero
+	void format( char * out ) const
+	{
+		out[0] = '0';
+		out[1] = '0';
+		out[2] = '-';
+		formatHex( mTraceIdHigh, 16, out + 3 );
+		formatHex( mTraceIdLow, 16, out + 19 );
+		out[35] = '-';
+		formatHex( mParentId, 16, out + 36 );
+		out[52] = '-';
+		formatHex( mFlags, 2, out + 53 );
+	}
+
+private:
+	static bool parseHex( const char * text, size_t digits, uint64_t & value )
+	{
+		value = 0;
+		for( size_t i = 0; i < digits; i++ ){
+			const char c = text[i];
+
+			if( c >= '0' && c <= '9' ){
+				value = ( value << 4 ) | static_cast<uint64_t>( c - '0' );
+			}else if( c >= 'a' && c <= 'f' ){
+				value = ( value << 4 ) | static_cast<uint64_t>( c - 'a' + 10 );
+			}else if( c >= 'A' && c <= 'F' ){
+				value = ( value << 4 ) | static_cast<uint64_t>( c - 'A' + 10 );
+			}else{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static void formatHex( uint64_t value, size_t digits, char * out )
+	{
+		static constexpr char	Digits[] = "0123456789abcdef";
+
+		for( size_t i = digits; i > 0; i-- ){
+			out[ i - 1 ] = Digits[ value & 0xf ];
+			value >>= 4;
+		}
+	}
+};
+
+}
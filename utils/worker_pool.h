@@ -0,0 +1,222 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <fmt/format.h>
+
+#include "span_metrics.h"
+
+namespace utils {
+
+struct ThreadsConfig
+{
+	size_t		mIOThreads = 0;			// cpprest threads: accept, parse, reply and run continuations. 0 keeps its default, 40
+	size_t		mWorkerThreads = 0;		// threads that run the handlers. 0 runs them on the cpprest threads
+	bool		mPin = false;			// pin each thread to one of the CPUs of the process, round robin
+	size_t		mListeners = 1;			// processes serving the port, each with these threads, see forkListeners
+};
+
+// Pins the calling thread to the next CPU the process may run on. Linux only.
+inline bool pinThread()
+{
+#ifdef __linux__
+	static const std::vector<int> cpus = [](){
+		std::vector<int>	res;
+		cpu_set_t			set;
+
+		CPU_ZERO( &set );
+		if( sched_getaffinity( 0, sizeof( set ), &set ) == 0 ){
+			for( int cpu = 0; cpu < CPU_SETSIZE; cpu++ ){
+				if( CPU_ISSET( cpu, &set )){
+					res.push_back( cpu );
+				}
+			}
+		}
+		return res;
+	}();
+	static std::atomic<size_t>	next{ 0 };
+	cpu_set_t					set;
+
+	if( cpus.empty() ){
+		return false;
+	}
+	CPU_ZERO( &set );
+	CPU_SET( cpus[ next++ % cpus.size() ], &set );
+	return pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+#else
+	return false;
+#endif
+}
+
+// How busy the threads of HTTPServer are and how long requests wait for a worker, for /metrics
+class ThreadStats
+{
+public:
+	struct Pool
+	{
+		std::atomic<size_t>		mThreads{ 0 };		// 0 when unknown
+		std::atomic<size_t>		mBusy{ 0 };
+	};
+
+	// Counts the thread as busy while alive
+	class Busy
+	{
+	public:
+		explicit Busy( Pool & pool ) : mPool( pool )
+		{
+			mPool.mBusy++;
+		}
+
+		~Busy()
+		{
+			mPool.mBusy--;
+		}
+
+		Busy( const Busy & ) = delete;
+		Busy & operator=( const Busy & ) = delete;
+
+	private:
+		Pool &	mPool;
+	};
+
+	Pool					mIO;
+	Pool					mWorkers;
+	std::atomic<size_t>		mQueued{ 0 };
+
+	// Called by one thread at a time
+	void waited( int64_t waitNs )
+	{
+		const uint64_t us = waitNs > 0 ? static_cast<uint64_t>( waitNs / 1000 ) : 0;
+
+		mWaitSumUs.store( mWaitSumUs.load( std::memory_order_relaxed ) + us, std::memory_order_relaxed );
+		mWait.record( us );
+	}
+
+	std::string prometheus() const
+	{
+		std::string		res = "# HELP http_threads Threads of each pool.\n# TYPE http_threads gauge\n";
+
+		appendPool( res, "http_threads", mIO.mThreads, mWorkers.mThreads );
+		res += "# HELP http_threads_busy Threads of each pool handling a request.\n# TYPE http_threads_busy gauge\n";
+		appendPool( res, "http_threads_busy", mIO.mBusy, mWorkers.mBusy );
+		if( mWorkers.mThreads > 0 ){
+			std::vector<uint64_t>	counts;
+
+			mWait.addTo( counts );
+			fmt::format_to( std::back_inserter( res ), "# HELP http_queue_length Requests waiting for a worker thread.\n# TYPE http_queue_length gauge\nhttp_queue_length {}\n", mQueued.load() );
+			res += "# HELP http_queue_wait_seconds Time requests waited for a worker thread.\n# TYPE http_queue_wait_seconds histogram\n";
+			appendHistogram( res, "http_queue_wait_seconds", "", counts, mWaitSumUs.load( std::memory_order_relaxed ));
+		}
+		return res;
+	}
+
+private:
+	LatencyHistogram		mWait;
+	std::atomic<uint64_t>	mWaitSumUs{ 0 };
+
+	static void appendPool( std::string & out, std::string_view name, const std::atomic<size_t> & io, const std::atomic<size_t> & workers )
+	{
+		fmt::format_to( std::back_inserter( out ), "{}{{pool=\"io\"}} {}\n{}{{pool=\"worker\"}} {}\n", name, io.load(), name, workers.load() );
+	}
+};
+
+// Runs the handlers out of the cpprest threads, so handlers that block waiting for other services do not stop
+// it from accepting and parsing requests. The queue is unbounded, its length and wait are in ThreadStats.
+class WorkerPool
+{
+public:
+	using Task = std::function<void()>;
+
+	WorkerPool( size_t threads, bool pin, ThreadStats & stats ) : mStats( stats )
+	{
+		mStats.mWorkers.mThreads = threads;
+		for( size_t i = 0; i < threads; i++ ){
+			mThreads.emplace_back( &WorkerPool::realRun, this, pin );
+		}
+	}
+
+	// Runs the tasks already queued
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex>	lock( mMutex );
+
+			mRunThreads = false;
+		}
+		mCondition.notify_all();
+		for( auto & thread: mThreads ){
+			thread.join();
+		}
+		mStats.mWorkers.mThreads = 0;
+	}
+
+	void submit( Task task )
+	{
+		{
+			std::lock_guard<std::mutex>	lock( mMutex );
+
+			mQueue.push_back({ std::move( task ), Clock::now() });
+			mStats.mQueued = mQueue.size();
+		}
+		mCondition.notify_one();
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Queued
+	{
+		Task				mTask;
+		Clock::time_point	mQueued;
+	};
+
+	ThreadStats &				mStats;
+	std::mutex					mMutex;
+	std::condition_variable		mCondition;
+	std::deque<Queued>			mQueue;
+	std::vector<std::thread>	mThreads;
+	bool						mRunThreads = true;
+
+	void realRun( bool pin )
+	{
+		if( pin ){
+			pinThread();
+		}
+		while( true ){
+			Task	task;
+
+			{
+				std::unique_lock<std::mutex>	lock( mMutex );
+
+				mCondition.wait( lock, [ this ](){ return !mQueue.empty() || !mRunThreads; });
+				if( mQueue.empty() ){
+					return;
+				}
+				task = std::move( mQueue.front().mTask );
+				mStats.waited( std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - mQueue.front().mQueued ).count() );
+				mQueue.pop_front();
+				mStats.mQueued = mQueue.size();
+			}
+			ThreadStats::Busy	busy( mStats.mWorkers );
+
+			task();
+		}
+	}
+};
+
+}